@@ -0,0 +1,8 @@
+// Statistics of the buffer cache, see bio.c.
+struct bcachestat {
+  uint nbuf;       // Buffers in the cache
+  uint maxbuf;     // Most buffers the cache grows to
+  uint hits;       // Lookups that found the block cached
+  uint misses;     // Lookups that had to read the block
+  uint contended;  // Lookups that found their bucket locked
+};
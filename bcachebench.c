@@ -0,0 +1,120 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "bcache.h"
+
+// Buffer cache benchmark.
+// Workers read the same NFILES files over and over, in parallel.
+// Prints the time taken, the hit rate of the buffer cache, and how
+// many lookups found their bucket locked. Run it with
+// "make qemu CPUS=n" for n = 1, 2, 4 and 8.
+
+#define NFILES 8
+#define FILESIZE (32 * 1024)
+#define NPASSES 4
+#define CHUNK 512
+
+char buf[CHUNK];
+
+void name(char *s, int i)
+{
+    strcpy(s, "bcbench0");
+    s[7] = '0' + i;
+}
+
+// Read every file NPASSES times, starting with file first.
+void worker(int first)
+{
+    char path[16];
+    int i, j, fd;
+
+    for (i = 0; i < NPASSES * NFILES; i++)
+    {
+        name(path, (first + i) % NFILES);
+        if ((fd = open(path, O_RDONLY)) < 0)
+        {
+            printf(1, "Open %s failed.\n", path);
+            exit();
+        }
+        for (j = 0; j < FILESIZE / CHUNK; j++)
+        {
+            if (read(fd, buf, CHUNK) != CHUNK)
+            {
+                printf(1, "Read %s failed.\n", path);
+                exit();
+            }
+        }
+        close(fd);
+    }
+}
+
+// Run nworkers workers in parallel, return elapsed ticks.
+int run(int nworkers)
+{
+    int i, start;
+
+    start = uptime();
+    for (i = 0; i < nworkers; i++)
+    {
+        if (fork() == 0)
+        {
+            worker(i);
+            exit();
+        }
+    }
+    for (i = 0; i < nworkers; i++)
+        wait();
+    return uptime() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bcachestat before, after;
+    char path[16];
+    int i, j, fd, nworkers, ticks, lookups;
+
+    printf(1, "================================\n");
+    printf(1, "Buffer cache benchmark started.\n");
+
+    for (i = 0; i < NFILES; i++)
+    {
+        name(path, i);
+        if ((fd = open(path, O_CREATE | O_RDWR)) < 0)
+        {
+            printf(1, "Create %s failed.\n", path);
+            exit();
+        }
+        memset(buf, 'a' + i, CHUNK);
+        for (j = 0; j < FILESIZE / CHUNK; j++)
+            write(fd, buf, CHUNK);
+        close(fd);
+    }
+
+    for (nworkers = 1; nworkers <= 8; nworkers *= 2)
+    {
+        bcachestat(&before);
+        ticks = run(nworkers);
+        bcachestat(&after);
+        if (ticks == 0)
+            ticks = 1;
+        lookups = (after.hits - before.hits) + (after.misses - before.misses);
+        if (lookups == 0)
+            lookups = 1;
+        printf(1, "%d workers: %d KB in %d ticks, %d KB per 100 ticks.\n", nworkers,
+               nworkers * NPASSES * NFILES * FILESIZE / 1024, ticks,
+               nworkers * NPASSES * NFILES * FILESIZE / 1024 * 100 / ticks);
+        printf(1, "  hit rate %d%%, %d of %d lookups contended, %d of %d buffers.\n",
+               (after.hits - before.hits) * 100 / lookups, after.contended - before.contended,
+               lookups, after.nbuf, after.maxbuf);
+    }
+
+    for (i = 0; i < NFILES; i++)
+    {
+        name(path, i);
+        unlink(path);
+    }
+    printf(1, "Buffer cache benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Large swap test.
+// Grows past the memstab capacity by NPAGES pages, so that 64MB is
+// swapped out. The compressed swap pool is turned off for the test,
+// so every page goes to the swap area on disk. Each page is stamped
+// with its index, then read back and checked.
+
+#define PGSIZE 4096
+#define NPAGES 16384  // 64MB
+#define STAMPS 8      // words stamped in each page
+
+int main(int argc, char *argv[])
+{
+    int i, j, bad, maxpages, faults, start, ticks;
+    uint *p;
+    char *base;
+
+    printf(1, "================================\n");
+    printf(1, "Large swap test started.\n");
+
+    swappolicy(SWAP_FIFO);
+    maxpages = zswapmax(0);
+
+    start = uptime();
+    base = sbrk(0);
+    for (i = 0; i < NPAGES + NUM_MEMSTAB_ENTRIES_CAPACITY; i++)
+    {
+        if ((p = (uint *)sbrk(PGSIZE)) == (uint *)-1)
+        {
+            printf(1, "sbrk failed after %d pages.\n", i);
+            zswapmax(maxpages);
+            exit();
+        }
+        for (j = 0; j < STAMPS; j++)
+            p[j * (PGSIZE / sizeof(uint) / STAMPS)] = i * STAMPS + j;
+    }
+    ticks = uptime() - start;
+    printf(1, "Swapped out %d MB in %d ticks.\n", NPAGES * PGSIZE / (1024 * 1024), ticks);
+
+    bad = 0;
+    faults = swapfaults();
+    start = uptime();
+    for (i = 0; i < NPAGES; i++)
+    {
+        p = (uint *)(base + i * PGSIZE);
+        for (j = 0; j < STAMPS; j++)
+            if (p[j * (PGSIZE / sizeof(uint) / STAMPS)] != i * STAMPS + j)
+                break;
+        if (j < STAMPS)
+            bad++;
+    }
+    ticks = uptime() - start;
+    printf(1, "Swapped in %d MB in %d ticks, %d swap faults.\n",
+           NPAGES * PGSIZE / (1024 * 1024), ticks, swapfaults() - faults);
+
+    zswapmax(maxpages);
+    if (bad)
+        printf(1, "Large swap test failed: %d bad pages.\n", bad);
+    else
+        printf(1, "Large swap test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,79 +17,344 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by device and block number into buckets with
+// a lock each, so that lookups of different blocks do not contend.
+// Idle clean buffers are also on an idle list, most recently released
+// first. A miss takes bcache.lock as well, to recycle the buffer at
+// the end of the idle list. The cache starts with NBUF buffers. While
+// more than BCACHE_FREE pages are free, a miss adds a chunk of buffers
+// from kalloc instead: a page of headers and the pages for their data.
+// The cache grows to 1/BCACHE_DIV of physical memory. When memory is
+// low, kswapd gives back chunks whose buffers are all idle.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcache.h"
 
-struct {
+#define NBUCKET 251  // prime, for a cache that grows to thousands of buffers
+// The multiplier of dev must not be a multiple of NBUCKET, or the same
+// block number on both disks would always share a bucket.
+#define BUCKET(dev, blockno) (&bcache.bucket[((dev) * 17 + (blockno)) % NBUCKET])
+
+#define BPP (PGSIZE/BSIZE)  // buffers per page
+
+// A chunk of buffers from kalloc: this header page, and CHUNKPAGES
+// pages for the data of its buffers.
+#define CHUNKBUF (((PGSIZE - sizeof(struct bchunk*)) / sizeof(struct buf)) / BPP * BPP)
+#define CHUNKPAGES (CHUNKBUF / BPP)
+
+struct bchunk {
+  struct bchunk *next;
+  struct buf buf[CHUNKBUF];
+};
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;   // list of the bucket's buffers, through prev/next
+  uint hits;
+  uint misses;
+  uint contended;    // lookups that found the lock held
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+extern char end[];  // first address after kernel, see kalloc.c
+
+struct {
+  struct spinlock lock;  // serializes misses and shrinking
+  struct buf buf[NBUF];
+  uint nbuf;             // buffers in the cache
+  uint maxbuf;           // most buffers, set from PHYSTOP
+  struct bchunk *chunks; // from kalloc, newest first
+  struct bucket bucket[NBUCKET];
+  struct spinlock idlelock;
+  struct buf idle;       // idle clean buffers, through lprev/lnext
 } bcache;
 
+#if BSIZE > PGSIZE || PGSIZE % BSIZE != 0
+#error "BSIZE must divide PGSIZE"
+#endif
+
+// Contents of the first NBUF blocks, apart from the headers so that
+// no block crosses a page. With BSIZE == PGSIZE every block is a
+// whole page, and so are the blocks carved from kalloc pages.
+static uchar bufdata[NBUF][BSIZE] __attribute__((__aligned__(PGSIZE)));
+
+static void
+bucket_acquire(struct bucket *bk)
+{
+  int busy = bk->lock.locked;
+
+  acquire(&bk->lock);
+  if(busy)
+    bk->contended++;
+}
+
+static void
+bucket_insert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+static void
+bucket_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Put b on the idle list, at the front if it was just released,
+// else at the end, to be recycled first.
+// A buffer is on the list, with lnext set, exactly when its refcnt
+// is 0 and B_DIRTY is clear. Both only change under its bucket lock,
+// which the caller holds.
+static void
+idle_insert(struct buf *b, int front)
+{
+  struct buf *after;
+
+  acquire(&bcache.idlelock);
+  after = front ? &bcache.idle : bcache.idle.lprev;
+  b->lnext = after->lnext;
+  b->lprev = after;
+  after->lnext->lprev = b;
+  after->lnext = b;
+  release(&bcache.idlelock);
+}
+
+// Caller holds the bucket lock of b.
+static void
+idle_remove(struct buf *b)
+{
+  acquire(&bcache.idlelock);
+  b->lnext->lprev = b->lprev;
+  b->lprev->lnext = b->lnext;
+  b->lnext = b->lprev = 0;
+  release(&bcache.idlelock);
+}
+
+// Put b back into its bucket, idle, at the end of the idle list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = BUCKET(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bucket_insert(bk, b);
+  b->refcnt = 0;
+  idle_insert(b, 0);
+  release(&bk->lock);
+}
+
+// Take b out of the cache if it is idle and clean, with a
+// reference for the caller. Returns 0 if it is not.
+// Caller holds bcache.lock, so b keeps its block.
+static int
+bclaim(struct buf *b)
+{
+  struct bucket *bk = BUCKET(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  if(b->lnext == 0){
+    release(&bk->lock);
+    return 0;
+  }
+  idle_remove(b);
+  bucket_remove(b);
+  b->refcnt = 1;
+  release(&bk->lock);
+  return 1;
+}
+
+// Add the n buffers from b on, with memory at data, to the cache,
+// idle and invalid.
+static void
+badd(struct buf *b, uchar *data, int n)
+{
+  for(; n > 0; n--, b++, data += BSIZE){
+    initsleeplock(&b->lock, "buffer");
+    b->data = data;
+    b->dev = b->blockno = 0;
+    b->flags = 0;
+    bput(b);
+    bcache.nbuf++;
+  }
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.idlelock, "bcache.idle");
+  bcache.idle.lprev = &bcache.idle;
+  bcache.idle.lnext = &bcache.idle;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
   }
+  for(i = 0; i < NBUF; i++)
+    badd(&bcache.buf[i], bufdata[i], 1);
+  if(CHUNKPAGES == 0)
+    panic("binit: struct buf too big");
+  bcache.maxbuf = NBUF +
+    (PHYSTOP - V2P(end)) / PGSIZE / BCACHE_DIV / (CHUNKPAGES + 1) * CHUNKBUF;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Add a chunk of buffers from kalloc, if memory is plentiful.
+// Caller holds bcache.lock.
+static void
+bgrow(void)
+{
+  struct bchunk *c;
+  char *mem[CHUNKPAGES];
+  int i;
+
+  if(bcache.nbuf + CHUNKBUF > bcache.maxbuf ||
+     get_num_free_pages() <= BCACHE_FREE + CHUNKPAGES)
+    return;
+  if((c = (struct bchunk*)kalloc()) == 0)
+    return;
+  for(i = 0; i < CHUNKPAGES; i++){
+    if((mem[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(mem[i]);
+      kfree((char*)c);
+      return;
+    }
+  }
+  memset(c, 0, PGSIZE);
+  for(i = 0; i < CHUNKPAGES; i++)
+    badd(&c->buf[i*BPP], (uchar*)mem[i], BPP);
+  c->next = bcache.chunks;
+  bcache.chunks = c;
+}
+
+// Give back chunks added by bgrow whose buffers are all idle and
+// clean, newest first, until n pages are freed. Returns the number
+// of pages freed.
+int
+bcache_shrink(int n)
+{
+  struct bchunk *c, **cp;
+  int i, freed;
+
+  freed = 0;
+  acquire(&bcache.lock);
+  for(cp = &bcache.chunks; (c = *cp) != 0 && freed < n; ){
+    for(i = 0; i < CHUNKBUF && bclaim(&c->buf[i]); i++)
+      ;
+    if(i < CHUNKBUF){
+      // One is in use, keep the chunk.
+      while(--i >= 0)
+        bput(&c->buf[i]);
+      cp = &c->next;
+      continue;
+    }
+    *cp = c->next;
+    for(i = 0; i < CHUNKPAGES; i++)
+      kfree((char*)c->buf[i*BPP].data);
+    kfree((char*)c);
+    bcache.nbuf -= CHUNKBUF;
+    freed += CHUNKPAGES + 1;
+  }
+  release(&bcache.lock);
+  return freed;
+}
+
+// Take the least recently used idle buffer out of its bucket.
+// Dirty buffers are not on the idle list: even if refcnt==0,
+// B_DIRTY indicates a buffer is in use because log.c has modified
+// it but not yet committed it.
+// Caller holds bcache.lock.
 static struct buf*
-bget(uint dev, uint blockno)
+brecycle(void)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
+  for(;;){
+    acquire(&bcache.idlelock);
+    b = bcache.idle.lprev;
+    release(&bcache.idlelock);
+    if(b == &bcache.idle)
+      return 0;
+    // A lookup may take it before we do.
+    if(bclaim(b))
+      return b;
+  }
+}
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+// Look for block on device dev in its bucket. If found, take a
+// reference. Caller holds the bucket lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
+      if(b->lnext != 0)
+        idle_remove(b);
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk = BUCKET(dev, blockno);
+  struct buf *b;
+
+  bucket_acquire(bk);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    bk->hits++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  bk->misses++;
+  release(&bk->lock);
+
+  // Not cached. Another miss may bring the block in while
+  // we wait for bcache.lock, so look again.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b == 0){
+    bgrow();  // new buffers are the least recently used
+    if((b = brecycle()) == 0)
+      panic("bget: no buffers");
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    acquire(&bk->lock);
+    bucket_insert(bk, b);
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -115,30 +380,67 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk. Must be locked, and stay
+// locked until bwait returns.
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  b->flags |= B_DIRTY;
+  iderw_start(b);
+}
+
+// Wait for a write started with bwrite_start.
+void
+bwait(struct buf *b)
+{
+  iderw_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move it to the front of the idle list once it is idle and clean.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = BUCKET(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
+  if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    idle_insert(b, 1);
   }
-  
+  release(&bk->lock);
+}
+
+// st is a user address and may fault, so it is only written
+// once no lock is held.
+void
+bcache_getstat(struct bcachestat *st)
+{
+  struct bcachestat s;
+  struct bucket *bk;
+
+  memset(&s, 0, sizeof(s));
+  acquire(&bcache.lock);
+  s.nbuf = bcache.nbuf;
   release(&bcache.lock);
+  s.maxbuf = bcache.maxbuf;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    s.hits += bk->hits;
+    s.misses += bk->misses;
+    s.contended += bk->contended;
+    release(&bk->lock);
+  }
+  *st = s;
 }
 //PAGEBREAK!
 // Blank page.
-
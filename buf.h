@@ -4,11 +4,18 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *lprev; // idle list, see bio.c
+  struct buf *lnext;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uchar **pages;     // raw request: memory to transfer, a page per 8 sectors
+  uint sector;       // raw request: first sector on disk
+  uint nsect;        // raw request: number of sectors
+  void (*done)(struct buf*);  // called by ideintr when the request is finished, if set
+  uchar *data;       // BSIZE bytes, within one page
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_RAW   0x8  // pages, sector and nsect describe the request, not blockno
 
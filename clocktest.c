@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Page replacement test.
+// A small hot working set is touched over and over while a cold
+// region is swept through once, growing the process past its memstab
+// capacity. FIFO evicts the hot pages (and the program's own text and
+// stack) as readily as the cold ones, CLOCK should keep them in memory.
+
+#define PGSIZE 4096
+#define HOT 8
+// Keep the excess small, so that the test is quick.
+#define COLD (NUM_MEMSTAB_ENTRIES_CAPACITY + 24 - HOT)
+#define HOT_INTERVAL 16
+
+char *hot[HOT];
+
+void touch_hot(void)
+{
+    int i;
+    for (i = 0; i < HOT; i++)
+        hot[i][0]++;
+}
+
+// Run the workload in a child with the given policy, return its swap-ins.
+int run(int policy)
+{
+    int i, fd[2], n;
+    char *p;
+
+    pipe(fd);
+    if (fork() == 0)
+    {
+        close(fd[0]);
+        swappolicy(policy);
+
+        for (i = 0; i < HOT; i++)
+        {
+            hot[i] = sbrk(PGSIZE);
+            hot[i][0] = 1;
+        }
+
+        for (i = 0; i < COLD; i++)
+        {
+            if ((p = sbrk(PGSIZE)) == (char *)-1)
+            {
+                printf(1, "sbrk failed after %d pages.\n", i);
+                break;
+            }
+            *p = 1;
+            if (i % HOT_INTERVAL == 0)
+                touch_hot();
+        }
+        touch_hot();
+
+        n = swapins();
+        write(fd[1], &n, sizeof(n));
+        exit();
+    }
+    close(fd[1]);
+    if (read(fd[0], &n, sizeof(n)) != sizeof(n))
+        n = -1;
+    close(fd[0]);
+    wait();
+    return n;
+}
+
+int main()
+{
+    int fifo, clock, bad;
+
+    printf(1, "================================\n");
+    printf(1, "Page replacement test started.\n");
+
+    fifo = run(SWAP_FIFO);
+    printf(1, "FIFO: %d swap-ins.\n", fifo);
+    clock = run(SWAP_CLOCK);
+    printf(1, "CLOCK: %d swap-ins.\n", clock);
+
+    // CLOCK keeps the hot pages, so it must swap in fewer than FIFO.
+    bad = fifo < 0 || clock < 0 || clock >= fifo;
+    if (bad)
+        printf(1, "Page replacement test failed.\n");
+    else
+        printf(1, "Page replacement test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -232,14 +232,18 @@ consoleintr(int (*getc)(void))
   }
 }
 
+// User memory is copied through buf, outside cons.lock: touching it
+// may fault, and the fault may sleep to read the page in.
 int
 consoleread(struct inode *ip, char *dst, int n)
 {
+  char buf[INPUT_BUF];
   uint target;
-  int c;
+  int c, m;
 
   iunlock(ip);
   target = n;
+  m = 0;
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
@@ -259,12 +263,20 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    buf[m++] = c;
     --n;
     if(c == '\n')
       break;
+    if(m == sizeof(buf)){
+      release(&cons.lock);
+      memmove(dst, buf, m);
+      dst += m;
+      m = 0;
+      acquire(&cons.lock);
+    }
   }
   release(&cons.lock);
+  memmove(dst, buf, m);
   ilock(ip);
 
   return target - n;
@@ -273,13 +285,18 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  char kbuf[INPUT_BUF];
+  int i, j, m;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(kbuf) ? n - i : sizeof(kbuf);
+    memmove(kbuf, buf + i, m);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(kbuf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
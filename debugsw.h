@@ -2,13 +2,5 @@
 #define SHOW_PAGEFAULT_INFO         0
 #define SHOW_PAGEFAULT_IA_ERR       0
 #define SHOW_STACK_GROWTH_INFO      0
-#define SHOW_SWAPALLOC_ENTER        0
-#define SHOW_SWAPALLOC_LEAVE        0
-#define SHOW_SWAPDEALLOC_ENTER      0
-#define SHOW_SWAPDEALLOC_LEAVE      0
-#define SHOW_SWAPREAD_ENTER         0
-#define SHOW_SWAPREAD_LEAVE         0
-#define SHOW_SWAPWRITE_ENTER        0
-#define SHOW_SWAPWRITE_LEAVE        0
-#define SHOW_SWAPPAGE_INFO          1
-#define SHOW_PAGE_SWAPOUT_INFO      1
\ No newline at end of file
+#define SHOW_SWAPPAGE_INFO          0
+#define SHOW_PAGE_SWAPOUT_INFO      0
\ No newline at end of file
@@ -1,7 +1,9 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstab_page_entry;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,12 +11,18 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct swapstab_page_entry;
+struct zswapstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_start(struct buf*);
+void            bwait(struct buf*);
+void            bcache_getstat(struct bcachestat*);
+int             bcache_shrink(int);
 
 // console.c
 void            consoleinit(void);
@@ -52,15 +60,13 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
-int             swapalloc(struct proc *p);
-int             swapdealloc(struct proc *p);
-int             swapread(struct proc *p, char *buf, uint offset, uint size);
-int             swapwrite(struct proc *p, char *buf, uint offset, uint size);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderw_start(struct buf*);
+void            iderw_wait(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -70,12 +76,18 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 uint            get_num_free_pages(void);
+uint            get_frag_index(void);
 void            incr_page_ref(int);
 void            decr_page_ref(int);
-ushort          get_page_ref(int);
+char*           get_zero_page(void);
+int             is_zero_page(uint);
+uint            get_page_ref(int);
+char*           copy_cow_page(uint);
 
 // kbd.c
 void            kbdintr(void);
@@ -99,6 +111,13 @@ void            end_op();
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(uint, uint, uint, uint);
+void            pcache_add(uint, uint, uint, uint, char*);
+void            pcache_invalidate(uint, uint);
+int             pcache_reclaim(int);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -125,6 +144,9 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kswapdinit(void);
+void            kswapd_wake(void);
+void            ksmdinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
@@ -133,6 +155,17 @@ void            swaptableinit(void);
 int             swapstab_growpage(struct proc *pr);
 void            memstab_clear(struct proc*);
 void            swapstab_clear(struct proc*);
+void            stab_free(struct proc*);
+struct memstab_page_entry*  memstab_lookup(struct proc*, char*);
+struct memstab_page_entry*  memstab_insert(struct proc*, char*);
+void            memstab_remove(struct proc*, struct memstab_page_entry*);
+void            memstab_movehead(struct proc*, struct memstab_page_entry*);
+void            memstab_moveafter(struct proc*, struct memstab_page_entry*, struct memstab_page_entry*);
+int             memstab_reserve(struct proc*, int);
+struct swapstab_page_entry* swapstab_lookup(struct proc*, char*);
+struct swapstab_page_entry* swapstab_insert(struct proc*, char*, int);
+void            swapstab_remove(struct proc*, struct swapstab_page_entry*);
+uint            swapstab_offset(struct swapstab_page_entry*);
 int             mkshm(int sig);
 int             rmshm(int sig);
 int             rdshm(int sig, char *buf);
@@ -156,6 +189,18 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// swap.c
+void            swapinit(void);
+int             swapslot_alloc(int*);
+void            swapslot_free(int);
+void            swapslot_dup(int);
+void            swaprw(int, char**, int, int);
+void            swapread(int, char**, int);
+void            swapwrite(int, char**, int);
+void            swap_sync(void);
+int             swap_pending(void);
+int             get_num_free_slots(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -201,6 +246,8 @@ char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
+int             countuvm(pde_t*);
+void            recorduvm(void);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
@@ -209,7 +256,21 @@ void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 void            pagefault(uint err_code);
+int             execprefault(uint, uint);
+void            wstick(void);
+void            age_pages(struct proc*);
+int             reclaim_pages(struct proc*, int);
+int             ksm_scan(struct proc**, int, uint, int);
+uint            get_ksm_saved(void);
 void            swappage(uint);
 
+// zswap.c
+void            zswapinit(void);
+int             zswap_store(int, char*);
+int             zswap_load(int, char*);
+void            zswap_invalidate(int);
+int             zswap_setmax(int);
+void            zswap_getstat(struct zswapstat*);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
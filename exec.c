@@ -14,8 +14,10 @@ exec(char *path, char **argv)
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip, *oldip;
   struct proghdr ph;
+  struct execseg segs[NEXECSEG];
+  int nsegs;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -28,6 +30,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  execip = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,16 +41,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Save data for swapping, restore them later.
-  // Normalily we can just clear them, but if exec failed,
-  // we need to be able to restore.
-
-  memstab_clear(curproc);
-  swapstab_clear(curproc);
-  
-  //todo Need a mechanism to save the swap table and restore it if exec fails.
-  
-  // Load program into memory.
+  // Record the program segments. Their pages are read in from
+  // the file on first touch, see execpage() in vm.c. A program
+  // with more than NEXECSEG segments has the rest loaded now.
+  nsegs = 0;
   sz = PGSIZE;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -58,15 +55,26 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > USERTOP - 2*PGSIZE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nsegs < NEXECSEG){
+      segs[nsegs].vaddr = ph.vaddr;
+      segs[nsegs].memsz = ph.memsz;
+      segs[nsegs].off = ph.off;
+      segs[nsegs].filesz = ph.filesz;
+      nsegs++;
+    } else if(allocuvm(pgdir, ph.vaddr, ph.vaddr + ph.memsz) == 0 ||
+              loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // Keep a reference to the file for the pages not read in yet.
+  iunlock(ip);
   end_op();
+  execip = ip;
   ip = 0;
 
   // Set sz to heap bottom.
@@ -105,20 +113,34 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
+  // memstab and swapstab describe the old image until the commit,
+  // since kswapd may work on them while exec sleeps. allocuvm() did
+  // not record the new pages; make sure they can be recorded then.
+  if(memstab_reserve(curproc, countuvm(pgdir)) < 0)
+    goto bad;
+
   // Commit to the user image.
+  memstab_clear(curproc);
+  swapstab_clear(curproc);
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->stack_size = PGSIZE;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
-
-  // Refresh swapfile.
-  swapdealloc(curproc);
-  swapalloc(curproc);
+  oldip = curproc->execip;
+  curproc->execip = execip;
+  curproc->nexecsegs = nsegs;
+  memmove(curproc->execsegs, segs, sizeof(segs));
+  recorduvm();
 
   switchuvm(curproc);
   freevm(oldpgdir);
+  if(oldip){
+    begin_op();
+    iput(oldip);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -128,11 +150,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
-
-  // Save data for swapping, restore them later.
-  // Normalily we can just clear them, but if exec failed,
-  // we need to be able to restore.
-  //todo Need a mechanism to save the swap table and restore it if exec fails.
-
+  if(execip){
+    begin_op();
+    iput(execip);
+    end_op();
+  }
   return -1;
 }
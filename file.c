@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "stat.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -80,13 +81,18 @@ fileclose(struct file *f)
 }
 
 // Get metadata about file f.
+// st is in user memory, which is only touched once the inode is
+// unlocked, see execpage().
 int
 filestat(struct file *f, struct stat *st)
 {
+  struct stat s;
+
   if(f->type == FD_INODE){
     ilock(f->ip);
-    stati(f->ip, st);
+    stati(f->ip, &s);
     iunlock(f->ip);
+    *st = s;
     return 0;
   }
   return -1;
@@ -103,6 +109,9 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
+    // Read in program pages of addr before the inode is locked.
+    if(execprefault((uint)addr, n) < 0)
+      return -1;
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
@@ -130,8 +139,13 @@ filewrite(struct file *f, char *addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+
+    // Read in program pages of addr before the log and the inode
+    // are taken.
+    if(execprefault((uint)addr, n) < 0)
+      return -1;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
@@ -146,9 +160,9 @@ filewrite(struct file *f, char *addr, int n)
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // the file could not grow
     }
     return i == n ? n : -1;
   }
@@ -19,10 +19,11 @@ struct inode {
 
   short type;         // copy of disk inode
   short major;
+  uchar flags;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // table mapping major device number to
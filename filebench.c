@@ -0,0 +1,78 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Large file throughput benchmark.
+// Writes a file of NCHUNKS chunks sequentially, reads it back and
+// checks it. Run it on a file system built with "make MKFSFLAGS=-x"
+// to compare extents with the classic block map.
+
+#define CHUNK 4096
+#define NCHUNKS 1024 // 4MB
+
+char buf[CHUNK];
+
+// Print kilobytes per second, uptime() ticks 100 times a second.
+void report(char *what, int ticks)
+{
+    if (ticks == 0)
+        ticks = 1;
+    printf(1, "%s %d KB in %d ticks, %d KB/s.\n", what, NCHUNKS * CHUNK / 1024, ticks,
+           NCHUNKS * CHUNK / 1024 * 100 / ticks);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, fd, start, bad;
+
+    printf(1, "================================\n");
+    printf(1, "Large file benchmark started.\n");
+
+    unlink("filebench.tmp");
+    if ((fd = open("filebench.tmp", O_CREATE | O_RDWR)) < 0)
+    {
+        printf(1, "Create failed.\n");
+        exit();
+    }
+    start = uptime();
+    for (i = 0; i < NCHUNKS; i++)
+    {
+        memset(buf, i, CHUNK);
+        if (write(fd, buf, CHUNK) != CHUNK)
+        {
+            printf(1, "Write failed at chunk %d.\n", i);
+            exit();
+        }
+    }
+    report("Wrote", uptime() - start);
+    close(fd);
+
+    if ((fd = open("filebench.tmp", O_RDONLY)) < 0)
+    {
+        printf(1, "Open failed.\n");
+        exit();
+    }
+    bad = 0;
+    start = uptime();
+    for (i = 0; i < NCHUNKS; i++)
+    {
+        if (read(fd, buf, CHUNK) != CHUNK)
+        {
+            printf(1, "Read failed at chunk %d.\n", i);
+            exit();
+        }
+        if (buf[0] != (char)i || buf[CHUNK - 1] != (char)i)
+            bad++;
+    }
+    report("Read", uptime() - start);
+    close(fd);
+    unlink("filebench.tmp");
+
+    if (bad)
+        printf(1, "Large file benchmark failed: %d bad chunks.\n", bad);
+    else
+        printf(1, "Large file benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,69 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Fork/exit throughput benchmark.
+// Run it with "make qemu CPUS=n" for n = 1, 2, 4 and 8 to see
+// how the kernel scales with the number of CPUs.
+
+#define NFORKS 200
+
+// Fork and reap NFORKS children, one at a time.
+void worker(void)
+{
+    int i, pid;
+    for (i = 0; i < NFORKS; i++)
+    {
+        pid = fork();
+        if (pid < 0)
+        {
+            printf(1, "Fork failed.\n");
+            exit();
+        }
+        if (pid == 0)
+            exit();
+        wait();
+    }
+}
+
+// Run nworkers workers in parallel, return elapsed ticks.
+int run(int nworkers)
+{
+    int i, start;
+
+    start = uptime();
+    for (i = 0; i < nworkers; i++)
+    {
+        if (fork() == 0)
+        {
+            worker();
+            exit();
+        }
+    }
+    for (i = 0; i < nworkers; i++)
+        wait();
+    return uptime() - start;
+}
+
+int main()
+{
+    int nworkers, ticks;
+
+    printf(1, "================================\n");
+    printf(1, "Fork benchmark started.\n");
+    printf(1, "Free pages before: %d\n", nfpgs());
+
+    for (nworkers = 1; nworkers <= 8; nworkers *= 2)
+    {
+        ticks = run(nworkers);
+        if (ticks == 0)
+            ticks = 1;
+        printf(1, "%d workers: %d forks in %d ticks, %d forks per 100 ticks.\n",
+               nworkers, nworkers * NFORKS, ticks, nworkers * NFORKS * 100 / ticks);
+    }
+
+    printf(1, "Free pages after: %d\n", nfpgs());
+    printf(1, "Fork benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,44 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Fork as many processes as the process table allows and keep them
+// all alive at once. Processes no longer hold swap files, so the
+// global file table (NFILE) does not limit this.
+
+int main()
+{
+    int n, fd[2];
+    char c;
+
+    printf(1, "================================\n");
+    printf(1, "Fork many test started.\n");
+    printf(1, "Free pages before: %d\n", nfpgs());
+
+    pipe(fd);
+    for (n = 0; n < NPROC; n++)
+    {
+        int pid = fork();
+        if (pid < 0)
+            break;
+        if (pid == 0)
+        {
+            // Wait until the parent closes the pipe.
+            close(fd[1]);
+            read(fd[0], &c, 1);
+            exit();
+        }
+    }
+    printf(1, "%d processes alive at once.\n", n);
+
+    close(fd[1]);
+    close(fd[0]);
+    while (wait() >= 0)
+        ;
+
+    printf(1, "Free pages after: %d\n", nfpgs());
+    printf(1, "Fork many test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -20,8 +20,6 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
-#include "fcntl.h"
-#include "debugsw.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -54,17 +52,23 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, the first free one at or after
+// near, so that blocks allocated one after another are contiguous.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint near)
 {
-  int b, bi, m;
+  int b, bi, m, i, nbmap;
   struct buf *bp;
 
+  if(near >= sb.size)
+    near = 0;
+  nbmap = (sb.size + BPB - 1) / BPB;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  // Come back around to the first bitmap block to look below near.
+  for(i = 0; i <= nbmap; i++){
+    b = (near / BPB + i) % nbmap * BPB;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(bi = i == 0 ? near % BPB : 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -186,6 +190,10 @@ iinit(int dev)
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  // Images made before the block size was recorded have 512-byte
+  // blocks and a zero in its place.
+  if((sb.bsize == 0 ? 512 : sb.bsize) != BSIZE)
+    panic("iinit: file system block size is not BSIZE");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -207,6 +215,8 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(sb.flags & SB_EXTENTS)
+        dip->flags = I_EXTENTS;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -230,6 +240,7 @@ iupdate(struct inode *ip)
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
+  dip->flags = ip->flags;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
@@ -303,6 +314,7 @@ ilock(struct inode *ip)
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
+    ip->flags = dip->flags;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
@@ -368,19 +380,107 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT blocks
+// are listed in the blocks listed in block ip->addrs[NDIRECT+1].
+//
+// An inode with I_EXTENTS lists runs of blocks instead, see fs.h.
+
+// Count the blocks after a[0] in a[0..n-1] that follow it on disk.
+static uint
+runlen(uint *a, uint n)
+{
+  uint i;
+
+  for(i = 1; i < n && a[i] == a[0] + i; i++)
+    ;
+  return i;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// which lists extents. If there is no such block, emap allocates
+// one, growing the last extent if the block after it is free.
+// Returns 0 if the inode is out of extents.
+static uint
+emap(struct inode *ip, uint bn, uint *run)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint i, addr;
+
+  bp = 0;
+  last = 0;
+  for(i = 0; i < NEXTENT + NIEXTENT; i++){
+    if(i == NEXTENT){
+      if(ip->addrs[NDIRECT+1] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    }
+    if(i < NEXTENT)
+      e = (struct extent*)ip->addrs + i;
+    else
+      e = (struct extent*)bp->data + (i - NEXTENT);
+    if(e->len == 0)
+      break;
+    if(bn < e->len){
+      addr = e->start + bn;
+      *run = e->len - bn;
+      goto out;
+    }
+    bn -= e->len;
+    last = e;
+  }
+
+  // Files have no holes, so the block is the one after the last.
+  if(bn != 0)
+    panic("emap: hole");
+  addr = balloc(ip->dev, last ? last->start + last->len : 0);
+  if(last && addr == last->start + last->len){
+    last->len++;
+  } else if(i == NEXTENT + NIEXTENT){
+    bfree(ip->dev, addr);
+    addr = 0;
+    goto out;
+  } else {
+    if(i == NEXTENT && bp == 0){
+      ip->addrs[NDIRECT+1] = balloc(ip->dev, 0);
+      bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    }
+    if(i < NEXTENT)
+      e = (struct extent*)ip->addrs + i;
+    else
+      e = (struct extent*)bp->data + (i - NEXTENT);
+    e->start = addr;
+    e->len = 1;
+  }
+  if(bp)
+    log_write(bp);
+  *run = 1;
+
+out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one. Sets *run to the
+// number of blocks from the nth on that follow each other on disk,
+// so that the caller can go through them without mapping each.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint *run)
 {
   uint addr, *a;
   struct buf *bp;
 
+  if(ip->flags & I_EXTENTS)
+    return emap(ip, bn, run);
+
+  *run = 1;
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, bn > 0 ? ip->addrs[bn-1] + 1 : 0);
+    else
+      *run = runlen(ip->addrs + bn, NDIRECT - bn);
     return addr;
   }
   bn -= NDIRECT;
@@ -388,20 +488,75 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip->dev, bn > 0 ? a[bn-1] + 1 : 0);
+      log_write(bp);
+    } else
+      *run = runlen(a + bn, NINDIRECT - bn);
+    brelse(bp);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the doubly-indirect block, then the indirect block
+    // listed in it, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, 0);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = balloc(ip->dev, 0);
       log_write(bp);
     }
     brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    bn %= NINDIRECT;
+    if((addr = a[bn]) == 0){
+      a[bn] = addr = balloc(ip->dev, bn > 0 ? a[bn-1] + 1 : 0);
+      log_write(bp);
+    } else
+      *run = runlen(a + bn, NINDIRECT - bn);
+    brelse(bp);
     return addr;
   }
 
   panic("bmap: out of range");
 }
 
+// Free the runs of blocks in e[0..n-1].
+static void
+efree(uint dev, struct extent *e, uint n)
+{
+  uint i, j;
+
+  for(i = 0; i < n && e[i].len > 0; i++)
+    for(j = 0; j < e[i].len; j++)
+      bfree(dev, e[i].start + j);
+}
+
+// Truncate an inode that lists extents.
+static void
+itrunc_extents(struct inode *ip)
+{
+  struct buf *bp;
+
+  efree(ip->dev, (struct extent*)ip->addrs, NEXTENT);
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    efree(ip->dev, (struct extent*)bp->data, NIEXTENT);
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->size = 0;
+  iupdate(ip);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -410,9 +565,16 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
+
+  pcache_invalidate(ip->dev, ip->inum);
+
+  if(ip->flags & I_EXTENTS){
+    itrunc_extents(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -433,6 +595,26 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint*)bp2->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(a2[k])
+          bfree(ip->dev, a2[k]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
@@ -455,7 +637,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -469,8 +651,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  // Every step but the last ends a block, so the next step is in
+  // the next block of the run, if any is left.
+  run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m, addr++, run--){
+    if(run == 0)
+      addr = bmap(ip, off/BSIZE, &run);
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -481,10 +668,12 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
+// Returns fewer than n bytes if an inode that lists extents runs
+// out of them; callers treat that as out of space.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -495,22 +684,30 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > (unsigned long long)MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+  // Cached pages of a program file go stale.
+  if(ip->type == T_FILE && n > 0)
+    pcache_invalidate(ip->dev, ip->inum);
+
+  run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m, addr++, run--){
+    // Out of extents: the write is cut short.
+    if(run == 0 && (addr = bmap(ip, off/BSIZE, &run)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot;
 }
 
 //PAGEBREAK!
@@ -551,6 +748,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Returns -1 if the name is present or the entry does not fit.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
@@ -574,8 +772,9 @@ dirlink(struct inode *dp, char *name, uint inum)
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
+  // Growing the directory can fail if it is out of extents.
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+    return -1;
 
   return 0;
 }
@@ -671,113 +870,3 @@ nameiparent(char *path, char *name)
 {
   return namex(path, 1, name);
 }
-
-int swapalloc(struct proc *p)
-{
-  if (SHOW_SWAPALLOC_ENTER)
-    cprintf("Entering swapalloc.\n");
-
-  int no;
-  for (no = 0; no < MAX_SWAPFILES; no++)
-  {
-    char path[20];
-    struct inode *in;
-
-    memmove(path, "./.swap", 7);
-    itoa(no, path + 7);
-    itoa(p->pid, path + 8);
-
-    begin_op();
-    in = create(path, T_FILE, 0, 0);
-    iunlock(in);
-
-    p->swapfile[no] = filealloc();
-    if (p->swapfile[no] == 0)
-      panic("[ERROR] No swapfile.");
-
-    p->swapfile[no]->ip = in;
-    p->swapfile[no]->type = FD_INODE;
-    p->swapfile[no]->off = 0;
-    p->swapfile[no]->readable = O_WRONLY;
-    p->swapfile[no]->writable = O_RDWR;
-
-    end_op();
-  }
-
-  if (SHOW_SWAPALLOC_LEAVE)
-    cprintf("Leaving swapalloc.\n");
-
-  return 0;
-}
-
-int swapdealloc(struct proc *p)
-{
-  if (SHOW_SWAPDEALLOC_ENTER)
-    cprintf("Entering swapdealloc.\n");
-
-  int no;
-  int res = 0;
-  for (no = 0; no < MAX_SWAPFILES; no++)
-  {
-    char path[20];
-
-    memmove(path, "./.swap", 7);
-    itoa(no, path + 7);
-    itoa(p->pid, path + 8);
-
-    if (0 == p->swapfile[no])
-    {
-      res = -1;
-      continue;
-    }
-    fileclose(p->swapfile[no]);
-
-    if (kunlink(path) == -1)
-      res = -1;
-  }
-
-  if (SHOW_SWAPDEALLOC_LEAVE)
-    cprintf("Leaving swapdealloc.\n");
-
-  return res;
-}
-
-int swapread(struct proc *pr, char *buf, uint offset, uint size)
-{
-  if (SHOW_SWAPREAD_ENTER)
-    cprintf("Entering swapread.\n");
-
-  int fileno = offset / SWAPFILE_LIMIT;
-
-  if (fileno < 0 || fileno > MAX_SWAPFILES)
-    panic("offset too big!");
-
-  int infileoffset = offset % SWAPFILE_LIMIT;
-
-  pr->swapfile[fileno]->off = infileoffset;
-
-  if (SHOW_SWAPREAD_LEAVE)
-    cprintf("Leaving swapread.\n");
-
-  return fileread(pr->swapfile[fileno], buf, size);
-}
-
-int swapwrite(struct proc *pr, char *buf, uint offset, uint size)
-{
-  if (SHOW_SWAPWRITE_ENTER)
-    cprintf("Entering swapwrite.\n");
-
-  int fileno = offset / SWAPFILE_LIMIT;
-
-  if (fileno < 0 || fileno > MAX_SWAPFILES)
-    panic("offset too big!");
-
-  int infileoffset = offset % SWAPFILE_LIMIT;
-
-  pr->swapfile[fileno]->off = infileoffset;
-
-  if (SHOW_SWAPWRITE_LEAVE)
-    cprintf("Leaving swapwrite.\n");
-
-  return filewrite(pr->swapfile[fileno], buf, size);
-}
\ No newline at end of file
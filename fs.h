@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size, at most PGSIZE, see the Makefile
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,20 +21,38 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // SB_EXTENTS
+  uint bsize;        // Block size the image was built with
 };
 
-#define NDIRECT 12
+#define SB_EXTENTS 1  // new inodes map their blocks with extents
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// An inode with I_EXTENTS set maps its blocks as runs of consecutive
+// blocks instead. The first NEXTENT extents are in addrs[0..NDIRECT],
+// the next NIEXTENT are in block addrs[NDIRECT+1].
+#define I_EXTENTS 1
+#define NEXTENT ((NDIRECT+1) / 2)
+#define NIEXTENT (BSIZE / sizeof(struct extent))
+
+struct extent {
+  uint start;  // First block of the run
+  uint len;    // Number of blocks in the run
+};
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEV only)
+  uchar major;          // Major device number (T_DEV only)
+  uchar flags;          // I_EXTENTS
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -23,13 +23,28 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+
+// Sectors moved per interrupt by READ/WRITE MULTIPLE: one page, so
+// that a raw request can scatter its pages anywhere in memory.
+#define MULTSECTS     (PGSIZE/SECTOR_SIZE)
+
+// Most sectors in one command.
+#define MAXSECTS      256
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// The queue is kept in elevator order, see idequeue_insert, and
+// idestart merges the bufs at its head into one command when they
+// follow each other on disk. The first idenbuf bufs are the active
+// command, of idensect sectors, of which idendone are transferred.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenbuf;
+static int idensect;
+static int idendone;
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -65,35 +80,134 @@ ideinit(void)
     }
   }
 
+  // Set the block size of READ/WRITE MULTIPLE on each disk.
+  for(i = 0; i <= havedisk1; i++){
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f2, MULTSECTS);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// First sector of b on disk.
+static uint
+bufsector(struct buf *b)
+{
+  return (b->flags & B_RAW) ? b->sector : b->blockno * (BSIZE/SECTOR_SIZE);
+}
+
+// Size of the transfer for b.
+static int
+bufnsect(struct buf *b)
+{
+  return (b->flags & B_RAW) ? b->nsect : BSIZE/SECTOR_SIZE;
+}
+
+// Memory for sector s of the transfer for b.
+static uchar*
+bufaddr(struct buf *b, int s)
+{
+  if(b->flags & B_RAW)
+    return b->pages[s/MULTSECTS] + s%MULTSECTS*SECTOR_SIZE;
+  return b->data + s*SECTOR_SIZE;
+}
+
+// Position of b for the elevator: disk first, then sector. LBA28
+// sectors fit below bit 28.
+static uint
+bufpos(struct buf *b)
+{
+  return ((b->dev & 1) << 28) | bufsector(b);
+}
+
+// Do a and b transfer any of the same sectors?
+static int
+bufoverlap(struct buf *a, struct buf *b)
+{
+  return a->dev == b->dev && bufsector(a) < bufsector(b) + bufnsect(b) &&
+         bufsector(b) < bufsector(a) + bufnsect(a);
+}
+
+// Sectors moved by the next interrupt of the active command.
+static int
+blocksect(void)
+{
+  return idensect - idendone < MULTSECTS ? idensect - idendone : MULTSECTS;
+}
+
+// Move n sectors of the active command, from sector idendone of
+// the command on, between the disk and the memory of its bufs.
+static void
+idexfer(int n, int write)
+{
+  struct buf *b;
+  int s, m;
+
+  b = idequeue;
+  for(s = idendone; s >= bufnsect(b); s -= bufnsect(b))
+    b = b->qnext;
+  while(n > 0){
+    if(s == bufnsect(b)){
+      b = b->qnext;
+      s = 0;
+    }
+    // The memory of a raw request is contiguous within a page.
+    m = bufnsect(b) - s;
+    if((b->flags & B_RAW) && m > MULTSECTS - s%MULTSECTS)
+      m = MULTSECTS - s%MULTSECTS;
+    if(m > n)
+      m = n;
+    if(write)
+      outsl(0x1f0, bufaddr(b, s), m*SECTOR_SIZE/4);
+    else
+      insl(0x1f0, bufaddr(b, s), m*SECTOR_SIZE/4);
+    s += m;
+    n -= m;
+  }
+}
+
+// Start the request for b, the head of idequeue, together with the
+// requests after it that go on where it ends, in the same direction.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *nb;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  idenbuf = 1;
+  idensect = bufnsect(b);
+  for(nb = b->qnext; nb != 0; nb = nb->qnext){
+    if(nb->dev != b->dev || (nb->flags & B_DIRTY) != (b->flags & B_DIRTY) ||
+       bufsector(nb) != bufsector(b) + idensect || idensect + bufnsect(nb) > MAXSECTS)
+      break;
+    idenbuf++;
+    idensect += bufnsect(nb);
+  }
+  idendone = 0;
 
-  if (sector_per_block > 7) panic("idestart");
+  int sector = bufsector(b);
+  if(idensect == 0 || idensect > MAXSECTS)
+    panic("idestart");
+  if(!(b->flags & B_RAW) && b->blockno >= FSSIZE)
+    panic("incorrect blockno");
+  int read_cmd = (idensect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (idensect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, idensect);  // number of sectors, 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    idexfer(blocksect(), 1);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,7 +217,8 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *done;
+  int i, write;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,33 +227,107 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  write = b->flags & B_DIRTY;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(!write){
+    if(idewait(1) >= 0)
+      idexfer(blocksect(), 0);
+    else
+      idendone = idensect - blocksect();  // the disk gave up
+  }
+
+  // A command of more than MULTSECTS sectors interrupts once per
+  // MULTSECTS; send the next ones.
+  idendone += blocksect();
+  if(idendone < idensect){
+    if(write){
+      idewait(0);
+      idexfer(blocksect(), 1);
+    }
+    release(&idelock);
+    return;
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for the bufs of the command. Bufs
+  // submitted with a completion function go on the done list.
+  done = 0;
+  for(i = 0; i < idenbuf; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->done){
+      b->qnext = done;
+      done = b;
+    } else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  // A buf with a completion function belongs to it from now on.
+  for(b = done; b != 0; b = done){
+    done = b->qnext;
+    b->done(b);
+  }
+}
+
+// Insert b into idequeue behind the active command, in C-LOOK order
+// of (disk, sector), see bufpos: first the requests at or past the
+// position where the active command starts, in ascending order, then
+// the ones before it, ascending. So the requests for one disk stay
+// together instead of alternating with the other's. A request never
+// goes ahead of one for any of the same sectors.
+// Caller must hold idelock.
+static void
+idequeue_insert(struct buf *b)
+{
+  struct buf **pp, **p, *last;
+  uint pos, s, e;
+  int i;
+
+  b->qnext = 0;
+  if(idequeue == 0){
+    idequeue = b;
+    return;
+  }
+
+  pos = bufpos(idequeue);
+  s = bufpos(b);
+  pp = &idequeue;
+  for(i = 0; i < idenbuf; i++)
+    pp = &(*pp)->qnext;
+
+  last = 0;
+  for(p = pp; *p; p = &(*p)->qnext)
+    if(bufoverlap(*p, b))
+      last = *p;
+
+  for(; *pp; pp = &(*pp)->qnext){
+    e = bufpos(*pp);
+    if(last == 0 && (s >= pos ? (e < pos || e > s) : (e < pos && e > s)))
+      break;
+    if(*pp == last)
+      last = 0;
+  }
+  b->qnext = *pp;
+  *pp = b;
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Start syncing buf with disk, without waiting for it.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If b->done is set, the interrupt handler calls it when the
+// request is finished. Otherwise wait for it with iderw_wait.
 void
-iderw(struct buf *b)
+iderw_start(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +337,30 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  idequeue_insert(b);
 
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
 
-  // Wait for request to finish.
+  release(&idelock);
+}
+
+// Wait for a request started with iderw_start to finish.
+void
+iderw_wait(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  iderw_start(b);
+  iderw_wait(b);
+}
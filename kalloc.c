@@ -1,30 +1,67 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous runs of 2^order pages with kalloc_order().
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// Free memory is managed by a binary buddy allocator. A free block
+// of order k is 2^k pages long and starts at a page number that is
+// a multiple of 2^k. Its buddy is the block of the same order whose
+// page number differs only in bit k; when both are free they are
+// merged into one block of order k+1.
+#define NPAGES       (PHYSTOP >> PGSHIFT)
+#define BUDDY_FREE   0x80  // page_order[] flag: head of a free block
+
+// Every CPU keeps a small cache of free pages in front of the
+// buddy allocator, so that kalloc() and kfree() normally only touch
+// memory owned by the current CPU. Pages move between a cache and
+// the buddy allocator KCACHE_BATCH at a time.
+#define KCACHE_SIZE  64   // Drain the cache when it holds this many pages.
+#define KCACHE_BATCH 32   // Pages moved per refill or drain.
+
 struct run {
   struct run *next;
+  struct run *prev;  // Only used on the buddy free lists.
 };
 
-struct {
+// The lock of a cache is only taken by its own CPU, except when
+// kalloc() runs out of pages and steals from other CPUs.
+struct kcache {
   struct spinlock lock;
-  int use_lock;
   struct run *freelist;
   uint num_free_pages;
-  ushort page_ref_count[PHYSTOP >> PGSHIFT];
+};
+
+struct {
+  struct spinlock lock;
+  int use_lock;
+  struct run *freelist[MAX_ORDER + 1];  // Free blocks of each order.
+  uint num_free_blocks[MAX_ORDER + 1];
+  uint num_free_pages;                  // Pages in the buddy free lists.
+  uchar page_order[NPAGES];             // Order | BUDDY_FREE for free block heads.
+  struct kcache cache[NCPU];
+
+  // Reference counts are only changed with lock-prefixed
+  // instructions (see x86.h), never under a lock.
+  volatile uint page_ref_count[NPAGES];
 } kmem;
 
+// A page of zeros, mapped read-only wherever a lazily allocated page
+// has only been read. The kernel keeps a reference of its own, so the
+// page is never freed and a write always takes a private copy.
+static char *zeropage;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -33,7 +70,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kcache");
   kmem.use_lock = 0;
   kmem.num_free_pages = 0;
   freerange(vstart, vend);
@@ -44,6 +85,10 @@ kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
   kmem.use_lock = 1;
+
+  if((zeropage = kalloc()) == 0)
+    panic("kinit2: zero page");
+  memset(zeropage, 0, PGSIZE);
 }
 
 void
@@ -60,6 +105,153 @@ freerange(void *vstart, void *vend)
     kmem.page_ref_count[V2P(p) >> PGSHIFT] = 0;
   }
 }
+
+//PAGEBREAK: 30
+// Buddy free lists. All of these must be called with kmem.lock held.
+
+static void
+buddy_push(uint pn, int order)
+{
+  struct run *r = (struct run*)P2V(pn << PGSHIFT);
+
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.num_free_blocks[order]++;
+  kmem.page_order[pn] = BUDDY_FREE | order;
+}
+
+static void
+buddy_remove(uint pn, int order)
+{
+  struct run *r = (struct run*)P2V(pn << PGSHIFT);
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.num_free_blocks[order]--;
+  kmem.page_order[pn] = 0;
+}
+
+// Return the block of 2^order pages starting at page number pn,
+// merging it with its buddy as long as the buddy is free.
+static void
+buddy_free(uint pn, int order)
+{
+  uint buddy;
+
+  kmem.num_free_pages += 1 << order;
+  while(order < MAX_ORDER){
+    buddy = pn ^ (1 << order);
+    if(buddy >= NPAGES || kmem.page_order[buddy] != (BUDDY_FREE | order))
+      break;
+    buddy_remove(buddy, order);
+    if(buddy < pn)
+      pn = buddy;
+    order++;
+  }
+  buddy_push(pn, order);
+}
+
+// Take a block of 2^order pages, splitting a larger block if
+// needed. Returns its page number, or -1 if there is none.
+static int
+buddy_alloc(int order)
+{
+  int k;
+  uint pn;
+
+  for(k = order; k <= MAX_ORDER; k++)
+    if(kmem.freelist[k] != 0)
+      break;
+  if(k > MAX_ORDER)
+    return -1;
+
+  pn = V2P(kmem.freelist[k]) >> PGSHIFT;
+  buddy_remove(pn, k);
+
+  // Give back the upper halves until the block is small enough.
+  while(k > order){
+    k--;
+    buddy_push(pn + (1 << k), k);
+  }
+  kmem.num_free_pages -= 1 << order;
+  return pn;
+}
+
+// Move up to n pages from the buddy allocator to cache c.
+// Caller must hold c->lock.
+static void
+kcache_refill(struct kcache *c, int n)
+{
+  struct run *r;
+  int pn;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (pn = buddy_alloc(0)) >= 0){
+    r = (struct run*)P2V(pn << PGSHIFT);
+    r->next = c->freelist;
+    c->freelist = r;
+    c->num_free_pages++;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from cache c back to the buddy allocator.
+// Caller must hold c->lock.
+static void
+kcache_drain(struct kcache *c, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->num_free_pages--;
+    buddy_free(V2P(r) >> PGSHIFT, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Return all pages cached by other CPUs to the buddy allocator.
+// Used when both the local cache and the buddy allocator are empty,
+// and before allocating a multi-page block, since cached pages
+// cannot be merged.
+static void
+kcache_steal(struct kcache *self)
+{
+  struct kcache *c;
+
+  for(c = kmem.cache; c < &kmem.cache[NCPU]; c++){
+    if(c == self || c->num_free_pages == 0)
+      continue;
+    acquire(&c->lock);
+    kcache_drain(c, c->num_free_pages);
+    release(&c->lock);
+  }
+}
+
+// Drop one reference to the page at v.
+// Returns 1 if that was the last one and the page should be freed.
+static int
+put_page_ref(char *v)
+{
+  volatile uint *ref;
+  uint old;
+
+  ref = &kmem.page_ref_count[V2P(v) >> PGSHIFT];
+  while((old = *ref) > 0){
+    if(cmpxchg(ref, old, old - 1) == old)
+      break;
+  }
+  return old <= 1;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -69,27 +261,35 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
+  // The page is only freed by whoever drops the last reference.
+  if(!put_page_ref(v))
+    return;
 
-  if(kmem.page_ref_count[V2P(v) >> PGSHIFT] > 0)
-    kmem.page_ref_count[V2P(v) >> PGSHIFT]--;
-  
-  if(kmem.page_ref_count[V2P(v) >> PGSHIFT] == 0)
-  {
-    memset(v, 1, PGSIZE);
-    kmem.num_free_pages++;
-    r = (struct run*) v;
-    r->next = kmem.freelist;
-    kmem.freelist = r;
+  memset(v, 1, PGSIZE);
+  r = (struct run*) v;
+
+  // Before kinit2() the other CPUs are not set up yet,
+  // so pages go straight to the buddy allocator.
+  if(!kmem.use_lock){
+    buddy_free(V2P(v) >> PGSHIFT, 0);
+    return;
   }
 
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->num_free_pages++;
+  if(c->num_free_pages >= KCACHE_SIZE)
+    kcache_drain(c, KCACHE_BATCH);
+  release(&c->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -99,38 +299,138 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+  int pn;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = 0;
+    if((pn = buddy_alloc(0)) >= 0)
+      r = (struct run*)P2V(pn << PGSHIFT);
+  } else {
+    pushcli();
+    c = &kmem.cache[cpuid()];
+    acquire(&c->lock);
+    if(c->freelist == 0)
+      kcache_refill(c, KCACHE_BATCH);
+    if(c->freelist == 0){
+      release(&c->lock);
+      kcache_steal(c);
+      acquire(&c->lock);
+      kcache_refill(c, KCACHE_BATCH);
+    }
+    r = c->freelist;
+    if(r){
+      c->freelist = r->next;
+      c->num_free_pages--;
+    }
+    release(&c->lock);
+    popcli();
+  }
+
+  // Nobody else can see a page that was on a freelist,
+  // so its reference count can be set without a lock.
   if(r)
-  {
-    kmem.num_free_pages--;
-    kmem.freelist = r->next;
     kmem.page_ref_count[V2P((void *)r) >> PGSHIFT] = 1;
-  }
-  if(kmem.use_lock)
-    release(&kmem.lock);
   return (char*)r;
 }
 
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Only the first page carries a reference count;
+// free the block with kfree_order() and the same order.
+// Returns 0 if no block that large is free.
+char*
+kalloc_order(int order)
+{
+  int pn;
+
+  if(order < 0 || order > MAX_ORDER)
+    panic("kalloc_order");
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pn = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(pn < 0){
+    // Pages sitting in the per-CPU caches might complete a block.
+    kcache_steal(0);
+    acquire(&kmem.lock);
+    pn = buddy_alloc(order);
+    release(&kmem.lock);
+    if(pn < 0)
+      return 0;
+  }
+
+  kmem.page_ref_count[pn] = 1;
+  return P2V(pn << PGSHIFT);
+}
+
+// Free a block returned by kalloc_order().
+void
+kfree_order(char *v, int order)
+{
+  if(order < 0 || order > MAX_ORDER)
+    panic("kfree_order");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  if(!put_page_ref(v))
+    return;
+
+  memset(v, 1, PGSIZE << order);
+  acquire(&kmem.lock);
+  buddy_free(V2P(v) >> PGSHIFT, order);
+  release(&kmem.lock);
+}
+
 // These functions must be called with kmem.use_lock = 1.
+// The per-CPU counts are read without their locks, so the
+// result is only a snapshot.
 uint get_num_free_pages(void)
 {
+  uint num_free_pages;
+  struct kcache *c;
+
   acquire(&kmem.lock);
-  uint num_free_pages = kmem.num_free_pages;
+  num_free_pages = kmem.num_free_pages;
   release(&kmem.lock);
+  for(c = kmem.cache; c < &kmem.cache[NCPU]; c++)
+    num_free_pages += c->num_free_pages;
   return num_free_pages;
 }
 
+// Fragmentation index: the percentage of free pages that cannot
+// be used for an allocation of 2^MAX_ORDER pages, because they are
+// in smaller free blocks or in the per-CPU caches. 0 means all free
+// memory is in maximal blocks, 100 means none of it is.
+uint get_frag_index(void)
+{
+  uint num_free_pages, usable;
+
+  num_free_pages = get_num_free_pages();
+  if(num_free_pages == 0)
+    return 0;
+
+  acquire(&kmem.lock);
+  usable = kmem.num_free_blocks[MAX_ORDER] << MAX_ORDER;
+  release(&kmem.lock);
+
+  if(usable > num_free_pages)
+    usable = num_free_pages;
+  return 100 - usable * 100 / num_free_pages;
+}
+
 void incr_page_ref(int paddr)
 {
   if (paddr > PHYSTOP || paddr < (uint)V2P(end))
     panic("incr_page_ref");
 
-  acquire(&kmem.lock);
-  kmem.page_ref_count[paddr >> PGSHIFT]++;
-  release(&kmem.lock);
+  xadd(&kmem.page_ref_count[paddr >> PGSHIFT], 1);
 }
 
 void decr_page_ref(int paddr)
@@ -138,21 +438,61 @@ void decr_page_ref(int paddr)
   if (paddr > PHYSTOP || paddr < (uint)V2P(end))
     panic("decr_page_ref");
 
-  acquire(&kmem.lock);
-  kmem.page_ref_count[paddr >> PGSHIFT]--;
-  release(&kmem.lock);
+  xadd(&kmem.page_ref_count[paddr >> PGSHIFT], -1);
+}
+
+// Take a reference to the shared zero page.
+char* get_zero_page(void)
+{
+  incr_page_ref(V2P(zeropage));
+  return zeropage;
 }
 
-ushort get_page_ref(int paddr)
+int is_zero_page(uint paddr)
+{
+  return paddr == V2P(zeropage);
+}
+
+uint get_page_ref(int paddr)
 {
   if (paddr > PHYSTOP || paddr < (uint)V2P(end))
     panic("get_page_ref");
 
-  ushort count;
+  return kmem.page_ref_count[paddr >> PGSHIFT];
+}
 
-  acquire(&kmem.lock);
-  count = kmem.page_ref_count[paddr >> PGSHIFT];
-  release(&kmem.lock);
+// Resolve a write to the copy-on-write page at paddr.
+// If the caller holds the only reference, the page itself is
+// returned and can simply be made writable. Otherwise the caller
+// gets a private copy and its reference to paddr is dropped.
+// The reference is only dropped after the copy is taken, so no
+// other owner can start writing to the page while it is copied.
+// Returns 0 if out of memory.
+char* copy_cow_page(uint paddr)
+{
+  char *mem;
+  uint ref;
+
+  if (paddr >= PHYSTOP || paddr < (uint)V2P(end))
+    panic("copy_cow_page");
 
-  return count;
-}
\ No newline at end of file
+  ref = kmem.page_ref_count[paddr >> PGSHIFT];
+  if (ref == 0)
+    panic("copy_cow_page: reference count error");
+
+  // A count of 1 means no other mapping exists: fork and ksmd raise
+  // the count before they share a frame. ksmd only shares frames of
+  // processes preempted in user mode, and we are running, so nothing
+  // can map this frame again until we return.
+  if (ref == 1)
+    return P2V(paddr);
+
+  if ((mem = kalloc()) == 0)
+    return 0;
+  if (is_zero_page(paddr))
+    memset(mem, 0, PGSIZE);
+  else
+    memmove(mem, P2V(paddr), PGSIZE);
+  kfree(P2V(paddr));
+  return mem;
+}
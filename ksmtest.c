@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Same-page merging test.
+// NCHILD children fill NPAGES pages each with the same data, then
+// keep running in user mode so that ksmd can stop and scan them.
+// Most of their pages should be merged. The children then check
+// their data, write to it and check it again.
+
+#define PGSIZE 4096
+#define NCHILD 4
+#define NPAGES 256
+#define DURATION 1000
+
+int main(int argc, char *argv[])
+{
+    int i, j, fd[2], saved, before, bad, end;
+    char *base;
+
+    printf(1, "================================\n");
+    printf(1, "Same-page merging test started.\n");
+
+    pipe(fd);
+    saved = ksmsaved();
+    before = nfpgs();
+    for (i = 0; i < NCHILD; i++)
+    {
+        if (fork() == 0)
+        {
+            close(fd[0]);
+            base = sbrk(NPAGES * PGSIZE);
+            for (j = 0; j < NPAGES * PGSIZE; j++)
+                base[j] = j / PGSIZE + 1;
+
+            end = uptime() + DURATION;
+            while (uptime() < end)
+                ;
+
+            bad = 0;
+            for (j = 0; j < NPAGES * PGSIZE; j++)
+                if (base[j] != (char)(j / PGSIZE + 1))
+                    bad = 1;
+            for (j = 0; j < NPAGES; j++)
+                base[j * PGSIZE] = i;
+            for (j = 0; j < NPAGES; j++)
+                if (base[j * PGSIZE] != i || base[j * PGSIZE + 1] != (char)(j + 1))
+                    bad = 1;
+            write(fd[1], &bad, sizeof(bad));
+            exit();
+        }
+    }
+    close(fd[1]);
+
+    sleep(DURATION / 2);
+    printf(1, "Halfway: %d frames merged, %d fewer free pages than at the start.\n",
+           ksmsaved() - saved, before - nfpgs());
+
+    bad = 0;
+    for (i = 0; i < NCHILD; i++)
+    {
+        if (read(fd[0], &j, sizeof(j)) != sizeof(j) || j)
+            bad = 1;
+        wait();
+    }
+    printf(1, "%d frames merged in all.\n", ksmsaved() - saved);
+
+    if (bad)
+        printf(1, "Same-page merging test failed.\n");
+    else
+        printf(1, "Same-page merging test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
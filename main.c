@@ -29,13 +29,18 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // page cache
   fileinit();      // file table
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   shmeminit();
   swaptableinit();
+  swapinit();      // swap area
+  zswapinit();     // compressed swap pool
   userinit();      // first user process
+  kswapdinit();    // page reclaimer
+  ksmdinit();      // same-page merger
   mpmain();        // finish this processor's setup
 }
 
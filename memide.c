@@ -58,3 +58,17 @@ iderw(struct buf *b)
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+// The memory disk is synchronous: start does the whole request.
+void
+iderw_start(struct buf *b)
+{
+  iderw(b);
+  if(b->done)
+    b->done(b);
+}
+
+void
+iderw_wait(struct buf *b)
+{
+}
@@ -31,6 +31,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int extents;  // -x: files list extents
 
 
 void balloc(int);
@@ -40,6 +41,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void convert(char *img);
 
 // convert to intel byte order
 ushort
@@ -76,8 +78,18 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc == 3 && strcmp(argv[1], "-c") == 0){
+    convert(argv[2]);
+    exit(0);
+  }
+  if(argc >= 2 && strcmp(argv[1], "-x") == 0){
+    extents = 1;
+    argc--;
+    argv++;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-x] fs.img files...\n");
+    fprintf(stderr, "       mkfs -c fs.img\n");
     exit(1);
   }
 
@@ -101,9 +113,11 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint(extents ? SB_EXTENTS : 0);
+  sb.bsize = xint(BSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d of %d bytes\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -228,6 +242,8 @@ ialloc(ushort type)
 
   bzero(&din, sizeof(din));
   din.type = xshort(type);
+  if(extents)
+    din.flags = I_EXTENTS;
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -252,6 +268,56 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Read the extents of an inode into e[0..NEXTENT+NIEXTENT-1].
+void
+rextents(struct dinode *din, struct extent *e)
+{
+  memmove(e, din->addrs, NEXTENT * sizeof(struct extent));
+  if(xint(din->addrs[NDIRECT+1]))
+    rsect(xint(din->addrs[NDIRECT+1]), e + NEXTENT);
+  else
+    bzero(e + NEXTENT, NIEXTENT * sizeof(struct extent));
+}
+
+void
+wextents(struct dinode *din, struct extent *e)
+{
+  memmove(din->addrs, e, NEXTENT * sizeof(struct extent));
+  if(xint(din->addrs[NDIRECT+1]))
+    wsect(xint(din->addrs[NDIRECT+1]), e + NEXTENT);
+}
+
+// Return the block fbn of an inode that lists extents, allocating
+// it if it is the block after the last.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent e[NEXTENT + NIEXTENT];
+  uint i, n, x;
+
+  rextents(din, e);
+  n = 0;
+  for(i = 0; i < NEXTENT + NIEXTENT && xint(e[i].len) > 0; i++){
+    if(fbn < n + xint(e[i].len))
+      return xint(e[i].start) + fbn - n;
+    n += xint(e[i].len);
+  }
+  assert(fbn == n);
+
+  if(i > 0 && xint(e[i-1].start) + xint(e[i-1].len) == freeblock){
+    e[i-1].len = xint(xint(e[i-1].len) + 1);
+  } else {
+    assert(i < NEXTENT + NIEXTENT);
+    if(i == NEXTENT)
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+    e[i].start = xint(freeblock);
+    e[i].len = xint(1);
+  }
+  x = freeblock++;
+  wextents(din, e);
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -260,7 +326,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, y, dbn;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -268,12 +334,14 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(din.flags & I_EXTENTS){
+      x = emap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -283,6 +351,23 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      dbn = fbn - NDIRECT - NINDIRECT;
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      if(indirect[dbn / NINDIRECT] == 0){
+        indirect[dbn / NINDIRECT] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      y = xint(indirect[dbn / NINDIRECT]);
+      rsect(y, (char*)indirect);
+      if(indirect[dbn % NINDIRECT] == 0){
+        indirect[dbn % NINDIRECT] = xint(freeblock++);
+        wsect(y, (char*)indirect);
+      }
+      x = xint(indirect[dbn % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +380,146 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Conversion of an existing image to extents.
+
+void
+bmark(uint b, int used)
+{
+  uchar buf[BSIZE];
+  uint bn = xint(sb.bmapstart) + b/BPB;
+
+  rsect(bn, buf);
+  if(used)
+    buf[b%BPB/8] |= 1 << (b%8);
+  else
+    buf[b%BPB/8] &= ~(1 << (b%8));
+  wsect(bn, buf);
+}
+
+// Find a free block and mark it in use.
+uint
+bclaim(void)
+{
+  uchar buf[BSIZE];
+  uint b;
+
+  for(b = 0; b < xint(sb.size); b++){
+    if(b % BPB == 0)
+      rsect(xint(sb.bmapstart) + b/BPB, buf);
+    if((buf[b%BPB/8] & (1 << (b%8))) == 0){
+      bmark(b, 1);
+      return b;
+    }
+  }
+  fprintf(stderr, "mkfs: out of blocks\n");
+  exit(1);
+}
+
+// Return block fbn of an inode with the classic layout.
+uint
+cbmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+
+  if(fbn < NDIRECT)
+    return xint(din->addrs[fbn]);
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT){
+    rsect(xint(din->addrs[NDIRECT]), indirect);
+    return xint(indirect[fbn]);
+  }
+  fbn -= NINDIRECT;
+  rsect(xint(din->addrs[NDIRECT+1]), indirect);
+  rsect(xint(indirect[fbn / NINDIRECT]), indirect);
+  return xint(indirect[fbn % NINDIRECT]);
+}
+
+// Free the indirect blocks of an inode with the classic layout.
+void
+cfree(struct dinode *din)
+{
+  uint indirect[NINDIRECT];
+  uint i;
+
+  if(xint(din->addrs[NDIRECT]))
+    bmark(xint(din->addrs[NDIRECT]), 0);
+  if(xint(din->addrs[NDIRECT+1]) == 0)
+    return;
+  rsect(xint(din->addrs[NDIRECT+1]), indirect);
+  for(i = 0; i < NINDIRECT; i++)
+    if(xint(indirect[i]))
+      bmark(xint(indirect[i]), 0);
+  bmark(xint(din->addrs[NDIRECT+1]), 0);
+}
+
+// Rewrite every inode of img with the classic layout to list
+// extents instead, keeping its data blocks where they are, and
+// make new inodes list extents. An inode whose blocks are in too
+// many runs is left as it is.
+void
+convert(char *img)
+{
+  struct extent e[NEXTENT + NIEXTENT];
+  struct dinode din;
+  char buf[BSIZE];
+  uint inum, fbn, nb, b, n, ndone;
+
+  fsfd = open(img, O_RDWR);
+  if(fsfd < 0){
+    perror(img);
+    exit(1);
+  }
+  rsect(1, buf);
+  memmove(&sb, buf, sizeof(sb));
+  // Older images do not record their block size, which was 512.
+  if(sb.bsize == 0)
+    sb.bsize = xint(512);
+  if(xint(sb.bsize) != BSIZE){
+    fprintf(stderr, "convert: %s has %u-byte blocks, mkfs was built for %d\n",
+            img, xint(sb.bsize), BSIZE);
+    exit(1);
+  }
+
+  ndone = 0;
+  for(inum = 1; inum < xint(sb.ninodes); inum++){
+    rinode(inum, &din);
+    if(din.type == 0 || xshort(din.type) == T_DEV || (din.flags & I_EXTENTS))
+      continue;
+
+    bzero(e, sizeof(e));
+    n = 0;
+    nb = (xint(din.size) + BSIZE - 1) / BSIZE;
+    for(fbn = 0; fbn < nb; fbn++){
+      b = cbmap(&din, fbn);
+      if(n > 0 && xint(e[n-1].start) + xint(e[n-1].len) == b){
+        e[n-1].len = xint(xint(e[n-1].len) + 1);
+      } else if(n == NEXTENT + NIEXTENT){
+        break;
+      } else {
+        e[n].start = xint(b);
+        e[n].len = xint(1);
+        n++;
+      }
+    }
+    if(fbn < nb){
+      printf("convert: inode %u has too many runs, left as is\n", inum);
+      continue;
+    }
+
+    cfree(&din);
+    bzero(din.addrs, sizeof(din.addrs));
+    if(n > NEXTENT)
+      din.addrs[NDIRECT+1] = xint(bclaim());
+    wextents(&din, e);
+    din.flags = I_EXTENTS;
+    winode(inum, &din);
+    ndone++;
+  }
+
+  sb.flags = xint(xint(sb.flags) | SB_EXTENTS);
+  rsect(1, buf);
+  memmove(buf, &sb, sizeof(sb));
+  wsect(1, buf);
+  printf("convert: %u inodes now list extents\n", ndone);
+}
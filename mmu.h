@@ -131,6 +131,9 @@ struct segdesc {
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define SPGSIZE         (PGSIZE*NPTENTRIES)  // bytes mapped by a superpage (PTE_PS)
+#define SPGROUNDDOWN(a) (((a)) & ~(SPGSIZE-1))
+
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
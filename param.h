@@ -7,8 +7,39 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // max loadable segments of a program
+#define NPCACHE     512  // pages of program files in the page cache
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3+LOGSIZE)  // initial size of disk block cache, with room for a commit in flight
+#define BCACHE_DIV   16  // the block cache grows to at most 1/BCACHE_DIV of physical memory
+#define BCACHE_FREE  (FREE_HIGH*2)  // the block cache grows while more pages than this are free
+#ifndef FSSIZE
+#define FSSIZE      20000  // size of file system in blocks, see the Makefile
+#endif
+#define SWAPDEV         0  // device number of the swap area
+#define SWAPSTART   10000  // first sector of the swap area, past the kernel
+#define NSWAPSLOTS  32768  // page-sized slots in the swap area (128MB)
+#define SWAPBATCH      16  // most pages moved by one swap area request
+#define NSWAPIO        32  // most swap-out requests in flight
+#define ZSWAP_PAGES  1024  // default size cap of the compressed swap pool, in pages
+#define NZSWAP       4096  // most swapped out pages in the compressed swap pool
+#define MAX_ORDER      10  // largest kalloc_order() block is 2^MAX_ORDER pages
+#define SUPERPAGES      1  // map aligned 4MB heap regions with one PDE
+#define SWAP_FIFO       0  // evict the page that was swapped in first
+#define SWAP_CLOCK      1  // like FIFO, but skip pages accessed since the last pass
+#define SWAP_WSCLOCK    2  // like CLOCK, but skip pages in the working set
+#define SWAP_POLICY     SWAP_WSCLOCK  // default page replacement policy
+#define WS_AGE_TICKS    5  // timer ticks between working set scans of a process
+#define WS_SLACK       64  // pages a process may keep beyond its working set
+#define RSS_MIN       128  // lowest resident limit of a process
+#define FREE_LOW     1024  // below this many free pages, kswapd trims processes to their working sets
+#define FREE_HIGH    (FREE_LOW + 64)  // kswapd stops at this many free pages
+#define TRIM_BATCH     32  // most pages kswapd swaps out of one process at a time
+#define RA_MAX  (SWAPBATCH-1)  // most pages read ahead of a sequential swap fault
+#define KSM_INTERVAL   10  // timer ticks between same-page merging scans
+#define NUM_MEMSTAB_PAGE_ENTRIES 204  // memstab entries in one table page, see proc.h
+#define NUM_MEMSTAB_PAGES         42  // most memstab table pages of a process
+#define NUM_MEMSTAB_ENTRIES_CAPACITY (NUM_MEMSTAB_PAGE_ENTRIES*NUM_MEMSTAB_PAGES)  // most pages of a process in memory
+#define KSM_PAGES     256  // most pages looked at by one same-page merging scan
 
@@ -0,0 +1,196 @@
+// Page cache.
+//
+// Pages of program files read in by execpage() in vm.c are kept here,
+// by device, inode number and file offset, so that every process
+// running the same program maps the same frames, read-only. A write
+// takes a private copy through copy on write.
+//
+// The cache holds a reference to each of its frames. When memory is
+// low, kswapd frees the least recently used frames that no process
+// maps any more. Writing to or truncating a file drops its pages.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
+#include "spinlock.h"
+
+#define PCHASH 64
+#define PCHASHSLOT(dev, inum) (((dev) * 31 + (inum)) % PCHASH)
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;              // File offset of the page
+  uint len;              // Bytes from the file, the rest is zeros
+  char *mem;             // 0 if the entry is free
+  struct pcpage *hnext;  // Pages of inodes in the same bucket
+  struct pcpage *prev;   // LRU list, most recently used first
+  struct pcpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage pages[NPCACHE];
+  struct pcpage *hash[PCHASH];
+  struct pcpage *free;
+  struct pcpage *head;
+  struct pcpage *tail;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  int i;
+
+  initlock(&pcache.lock, "pcache");
+  for(i = 0; i < NPCACHE; i++){
+    pcache.pages[i].hnext = pcache.free;
+    pcache.free = &pcache.pages[i];
+  }
+}
+
+static void
+lru_remove(struct pcpage *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    pcache.head = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  else
+    pcache.tail = pg->prev;
+}
+
+static void
+lru_push(struct pcpage *pg)
+{
+  pg->prev = 0;
+  pg->next = pcache.head;
+  if(pcache.head)
+    pcache.head->prev = pg;
+  else
+    pcache.tail = pg;
+  pcache.head = pg;
+}
+
+// Unlink pg from its bucket, given the link pointing to it,
+// drop the cache's reference and free the entry.
+static void
+pcdrop(struct pcpage **pp)
+{
+  struct pcpage *pg = *pp;
+
+  *pp = pg->hnext;
+  lru_remove(pg);
+  kfree(pg->mem);
+  pg->mem = 0;
+  pg->hnext = pcache.free;
+  pcache.free = pg;
+}
+
+// Return the cached page of the file at off, with a reference for
+// the caller, or 0 if it is not cached.
+char*
+pcache_get(uint dev, uint inum, uint off, uint len)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.hash[PCHASHSLOT(dev, inum)]; pg != 0; pg = pg->hnext){
+    if(pg->dev == dev && pg->inum == inum && pg->off == off && pg->len == len){
+      incr_page_ref(V2P(pg->mem));
+      lru_remove(pg);
+      lru_push(pg);
+      release(&pcache.lock);
+      return pg->mem;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Cache mem as the page of the file at off. The cache takes a
+// reference of its own. If the cache is full of pages in use, or
+// another process has cached the page meanwhile, nothing is done.
+void
+pcache_add(uint dev, uint inum, uint off, uint len, char *mem)
+{
+  struct pcpage *pg, **pp;
+  uint h = PCHASHSLOT(dev, inum);
+
+  acquire(&pcache.lock);
+  for(pg = pcache.hash[h]; pg != 0; pg = pg->hnext){
+    if(pg->dev == dev && pg->inum == inum && pg->off == off && pg->len == len){
+      release(&pcache.lock);
+      return;
+    }
+  }
+
+  // Full: take the least recently used page no process maps.
+  if(pcache.free == 0){
+    for(pg = pcache.tail; pg != 0 && get_page_ref(V2P(pg->mem)) > 1; pg = pg->prev)
+      ;
+    if(pg == 0){
+      release(&pcache.lock);
+      return;
+    }
+    for(pp = &pcache.hash[PCHASHSLOT(pg->dev, pg->inum)]; *pp != pg; pp = &(*pp)->hnext)
+      ;
+    pcdrop(pp);
+  }
+
+  pg = pcache.free;
+  pcache.free = pg->hnext;
+  pg->dev = dev;
+  pg->inum = inum;
+  pg->off = off;
+  pg->len = len;
+  pg->mem = mem;
+  incr_page_ref(V2P(mem));
+  pg->hnext = pcache.hash[h];
+  pcache.hash[h] = pg;
+  lru_push(pg);
+  release(&pcache.lock);
+}
+
+// Drop the cached pages of an inode whose contents change.
+// Processes that map them keep their references.
+void
+pcache_invalidate(uint dev, uint inum)
+{
+  struct pcpage **pp;
+
+  acquire(&pcache.lock);
+  for(pp = &pcache.hash[PCHASHSLOT(dev, inum)]; *pp != 0; ){
+    if((*pp)->dev == dev && (*pp)->inum == inum)
+      pcdrop(pp);
+    else
+      pp = &(*pp)->hnext;
+  }
+  release(&pcache.lock);
+}
+
+// Free up to n cached pages that no process maps, least recently
+// used first. Returns the number of pages freed.
+int
+pcache_reclaim(int n)
+{
+  struct pcpage *pg, *prev, **pp;
+  int freed = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.tail; pg != 0 && freed < n; pg = prev){
+    prev = pg->prev;
+    if(get_page_ref(V2P(pg->mem)) > 1)
+      continue;
+    for(pp = &pcache.hash[PCHASHSLOT(pg->dev, pg->inum)]; *pp != pg; pp = &(*pp)->hnext)
+      ;
+    pcdrop(pp);
+    freed++;
+  }
+  release(&pcache.lock);
+  return freed;
+}
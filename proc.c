@@ -51,15 +51,17 @@ void swaptableinit(void)
     thisproc->num_mem_entries = 0;
     thisproc->memstab_head = 0;
     thisproc->memstab_tail = 0;
+    thisproc->memstab_free = 0;
+    thisproc->memstab_hash = 0;
     thisproc->swapstab_head = 0;
     thisproc->swapstab_tail= 0;
+    thisproc->swapstab_free = 0;
+    thisproc->swapstab_hash = 0;
     thisproc->memqueue_head = 0;
     thisproc->memqueue_tail = 0;
     thisproc->num_swapstab_pages = 0;
-
-    int j;
-    for (j = 0; j < MAX_SWAPFILES; j++)
-      thisproc->swapfile[j] = 0;
+    thisproc->num_memstab_pages = 0;
+    thisproc->num_swapped = 0;
   }
   release(&ptable.lock);
 }
@@ -73,6 +75,10 @@ void memstab_page_clear(struct memstab_page *page, uint clear_link)
   {
     page->entries[i].prev = 0;
     page->entries[i].next = 0;
+    page->entries[i].hnext = 0;
+    page->entries[i].age = 0;
+    page->entries[i].readahead = 0;
+    page->entries[i].superpage = 0;
     page->entries[i].vaddr = SLOT_USABLE;
   }
   if (clear_link)
@@ -94,38 +100,235 @@ struct memstab_page *memstab_page_alloc(void)
 
 // Clear a process's memory swap table. But the memory is not released.
 // This function is designed for reuse the allocated memory.
+// All entries are put on the free slot stack, and the hash is emptied.
 void memstab_clear(struct proc *pr)
 {
+  int i;
   struct memstab_page *p = pr->memstab_head;
+
+  pr->memstab_free = 0;
   while (p != 0)
   {
     memstab_page_clear(p, 0);
+    for (i = NUM_MEMSTAB_PAGE_ENTRIES - 1; i >= 0; i--)
+    {
+      p->entries[i].next = pr->memstab_free;
+      pr->memstab_free = &(p->entries[i]);
+    }
     p = p->next;
   }
+  if (pr->memstab_hash != 0)
+    memset(pr->memstab_hash, 0, STAB_HASH_SIZE * sizeof(pr->memstab_hash[0]));
   pr->num_mem_entries = 0;
   pr->memqueue_head = 0;
   pr->memqueue_tail = 0;
 }
 
-// Allocate a full memory swap table, return its head address.
-// The swaptable is linked.
-struct memstab_page * memstab_alloc(void)
+// Allocate an empty page of bucket pointers for a swap table hash.
+static void **stab_hash_alloc(void)
 {
-  int i;
-  struct memstab_page *slow, *fast, *head;
-  if ((slow = memstab_page_alloc()) == 0)
+  void **hash;
+  if ((hash = (void **)kalloc()) == 0)
     return 0;
-  head = slow;
-  for (i = 0; i < NUM_MEMSTAB_PAGES - 1; i++)
+  memset(hash, 0, STAB_HASH_SIZE * sizeof(hash[0]));
+  return hash;
+}
+
+// Add a page to the memory swap table and put its entries on the free
+// slot stack. The table and its hash are allocated the first time a
+// page is recorded, and grow up to NUM_MEMSTAB_PAGES pages.
+// Returns 0 on success, otherwise -1.
+static int memstab_growpage(struct proc *pr)
+{
+  int i;
+  struct memstab_page *page;
+
+  if (pr->num_memstab_pages >= NUM_MEMSTAB_PAGES)
+    return -1;
+  if (pr->memstab_hash == 0 &&
+      (pr->memstab_hash = (struct memstab_page_entry **)stab_hash_alloc()) == 0)
+    return -1;
+  if ((page = memstab_page_alloc()) == 0)
+    return -1;
+
+  if (pr->memstab_head == 0)
+    pr->memstab_head = page;
+  else
   {
-    if ((fast = memstab_page_alloc()) == 0)
-      return 0;
-    slow->next = fast;
-    fast->prev = slow;
-    slow = fast;
+    pr->memstab_tail->next = page;
+    page->prev = pr->memstab_tail;
+  }
+  pr->memstab_tail = page;
+  pr->num_memstab_pages++;
+
+  for (i = NUM_MEMSTAB_PAGE_ENTRIES - 1; i >= 0; i--)
+  {
+    page->entries[i].next = pr->memstab_free;
+    pr->memstab_free = &(page->entries[i]);
   }
+  return 0;
+}
+
+// Release all swap table memory of a process, whose swap slots
+// have already been freed by swapstab_clear.
+void stab_free(struct proc *pr)
+{
+  struct memstab_page *mp, *mnext;
+  struct swapstab_page *sp, *snext;
+
+  for (mp = pr->memstab_head; mp != 0; mp = mnext)
+  {
+    mnext = mp->next;
+    kfree((char *)mp);
+  }
+  for (sp = pr->swapstab_head; sp != 0; sp = snext)
+  {
+    snext = sp->next;
+    kfree((char *)sp);
+  }
+  if (pr->memstab_hash != 0)
+    kfree((char *)pr->memstab_hash);
+  if (pr->swapstab_hash != 0)
+    kfree((char *)pr->swapstab_hash);
+
+  pr->memstab_head = pr->memstab_tail = 0;
+  pr->memstab_free = 0;
+  pr->memstab_hash = 0;
+  pr->memqueue_head = pr->memqueue_tail = 0;
+  pr->swapstab_head = pr->swapstab_tail = 0;
+  pr->swapstab_free = 0;
+  pr->swapstab_hash = 0;
+  pr->num_mem_entries = 0;
+  pr->num_memstab_pages = 0;
+  pr->num_swapstab_pages = 0;
+  pr->num_swapped = 0;
+}
+
+// Find the memstab entry of the page at va, or 0 if it is not recorded.
+struct memstab_page_entry *memstab_lookup(struct proc *pr, char *va)
+{
+  struct memstab_page_entry *e;
+
+  if (pr->memstab_hash == 0)
+    return 0;
+  for (e = pr->memstab_hash[STAB_HASH(va)]; e != 0; e = e->hnext)
+    if (e->vaddr == va)
+      return e;
+  return 0;
+}
+
+// Record the page at va as the newest page in memory.
+// Returns the entry, or 0 if the memstab is full.
+struct memstab_page_entry *memstab_insert(struct proc *pr, char *va)
+{
+  struct memstab_page_entry *e, **bucket;
 
-  return head;
+  if (pr->memstab_free == 0 && memstab_growpage(pr) != 0)
+    return 0;
+  e = pr->memstab_free;
+  pr->memstab_free = e->next;
+
+  e->vaddr = va;
+  e->age = 0;
+  e->readahead = 0;
+  e->superpage = 0;
+  bucket = &(pr->memstab_hash[STAB_HASH(va)]);
+  e->hnext = *bucket;
+  *bucket = e;
+
+  e->prev = 0;
+  e->next = pr->memqueue_head;
+  if (pr->memqueue_head == 0)
+    pr->memqueue_tail = e;
+  else
+    pr->memqueue_head->prev = e;
+  pr->memqueue_head = e;
+  return e;
+}
+
+// Make sure n more pages can be recorded without growing the table.
+// Returns 0 on success, otherwise -1.
+int memstab_reserve(struct proc *pr, int n)
+{
+  struct memstab_page_entry *e;
+  int nfree = 0;
+
+  for (e = pr->memstab_free; e != 0 && nfree < n; e = e->next)
+    nfree++;
+  for (; nfree < n; nfree += NUM_MEMSTAB_PAGE_ENTRIES)
+    if (memstab_growpage(pr) != 0)
+      return -1;
+  return 0;
+}
+
+// Move a recorded page to the head of the memqueue.
+void memstab_movehead(struct proc *pr, struct memstab_page_entry *e)
+{
+  if (pr->memqueue_head == e)
+    return;
+
+  e->prev->next = e->next;
+  if (e->next != 0)
+    e->next->prev = e->prev;
+  else
+    pr->memqueue_tail = e->prev;
+
+  e->prev = 0;
+  e->next = pr->memqueue_head;
+  pr->memqueue_head->prev = e;
+  pr->memqueue_head = e;
+}
+
+// Move a recorded page to right behind pos in the memqueue, so that
+// it is swapped out just before pos.
+void memstab_moveafter(struct proc *pr, struct memstab_page_entry *e, struct memstab_page_entry *pos)
+{
+  if (e == pos || pos->next == e)
+    return;
+
+  if (e->prev != 0)
+    e->prev->next = e->next;
+  else
+    pr->memqueue_head = e->next;
+  if (e->next != 0)
+    e->next->prev = e->prev;
+  else
+    pr->memqueue_tail = e->prev;
+
+  e->prev = pos;
+  e->next = pos->next;
+  if (pos->next != 0)
+    pos->next->prev = e;
+  else
+    pr->memqueue_tail = e;
+  pos->next = e;
+}
+
+// Forget a recorded page: take it off the memqueue and the hash,
+// and put its entry back on the free slot stack.
+void memstab_remove(struct proc *pr, struct memstab_page_entry *e)
+{
+  struct memstab_page_entry **pp;
+
+  if (e->prev != 0)
+    e->prev->next = e->next;
+  else
+    pr->memqueue_head = e->next;
+  if (e->next != 0)
+    e->next->prev = e->prev;
+  else
+    pr->memqueue_tail = e->prev;
+
+  for (pp = &(pr->memstab_hash[STAB_HASH(e->vaddr)]); *pp != e; pp = &((*pp)->hnext))
+    if (*pp == 0)
+      panic("memstab_remove");
+  *pp = e->hnext;
+
+  e->vaddr = SLOT_USABLE;
+  e->prev = 0;
+  e->hnext = 0;
+  e->next = pr->memstab_free;
+  pr->memstab_free = e;
 }
 
 // Clear one swapped swap table page. If clear_link is set, it will also clear pointers to prev and next page.
@@ -133,7 +336,10 @@ void swapstab_page_clear(struct swapstab_page *page, uint clear_link)
 {
   int i;
   for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
+  {
     page->entries[i].vaddr = SLOT_USABLE;
+    page->entries[i].hnext = 0;
+  }
   if (clear_link)
   {
     page->next = 0;
@@ -151,18 +357,62 @@ struct swapstab_page* swapstab_page_alloc(void)
   return sstabpg;
 }
 
-// Clear the swapped swap table for a process. 
+// Push the unused entries of a swapped swap table page on the free
+// slot stack and hash the used ones. Lower entries are handed out first.
+static void swapstab_page_index(struct proc *pr, struct swapstab_page *page)
+{
+  int i;
+  struct swapstab_page_entry *e, **bucket;
+
+  for (i = NUM_SWAPSTAB_PAGE_ENTRIES - 1; i >= 0; i--)
+  {
+    e = &(page->entries[i]);
+    if (e->vaddr == SLOT_USABLE)
+    {
+      e->hnext = pr->swapstab_free;
+      pr->swapstab_free = e;
+    }
+    else
+    {
+      bucket = &(pr->swapstab_hash[STAB_HASH(e->vaddr)]);
+      e->hnext = *bucket;
+      *bucket = e;
+    }
+  }
+}
+
+// Rebuild the free slot stack and the hash of a swapped swap table
+// from the vaddr fields of its entries.
+static void swapstab_reindex(struct proc *pr)
+{
+  struct swapstab_page *p;
+
+  pr->swapstab_free = 0;
+  if (pr->swapstab_hash == 0)
+    return;
+  memset(pr->swapstab_hash, 0, STAB_HASH_SIZE * sizeof(pr->swapstab_hash[0]));
+  for (p = pr->swapstab_tail; p != 0; p = p->prev)
+    swapstab_page_index(pr, p);
+}
+
+// Clear the swapped swap table for a process and free its swap slots.
 // Preserve space and link relation.
 void swapstab_clear(struct proc *pr)
 {
   struct swapstab_page *p;
+  int i;
 
   p = pr->swapstab_head;
   while (p != 0)
   {
+    for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
+      if (p->entries[i].vaddr != SLOT_USABLE)
+        swapslot_free(p->entries[i].slot);
     swapstab_page_clear(p, 0);
     p = p->next;
   }
+  pr->num_swapped = 0;
+  swapstab_reindex(pr);
 }
 
 int swapstab_growpage(struct proc *pr)
@@ -170,6 +420,11 @@ int swapstab_growpage(struct proc *pr)
   struct swapstab_page **head, **tail;
   head = &(pr->swapstab_head);
   tail = &(pr->swapstab_tail);
+
+  // The hash is allocated with the first page.
+  if (pr->swapstab_hash == 0 &&
+      (pr->swapstab_hash = (struct swapstab_page_entry **)stab_hash_alloc()) == 0)
+    return -1;
   
   // Start growing.
   if (*head == 0)
@@ -188,64 +443,101 @@ int swapstab_growpage(struct proc *pr)
     temp->next = *tail;
     (*tail)->prev = temp;
   }
+  pr->num_swapstab_pages++;
+  swapstab_page_index(pr, *tail);
 
   return 0;
 }
 
+// Find the swapstab entry of the swapped out page at va, or 0.
+struct swapstab_page_entry *swapstab_lookup(struct proc *pr, char *va)
+{
+  struct swapstab_page_entry *e;
+
+  if (pr->swapstab_hash == 0)
+    return 0;
+  for (e = pr->swapstab_hash[STAB_HASH(va)]; e != 0; e = e->hnext)
+    if (e->vaddr == va)
+      return e;
+  return 0;
+}
+
+// Take a free swapstab entry for the page at va, which is kept in
+// slot, growing the table if all entries are used. Returns 0 if
+// out of memory.
+struct swapstab_page_entry *swapstab_insert(struct proc *pr, char *va, int slot)
+{
+  struct swapstab_page_entry *e, **bucket;
+
+  if (pr->swapstab_free == 0 && swapstab_growpage(pr) != 0)
+    return 0;
+  e = pr->swapstab_free;
+  e->slot = slot;
+  pr->num_swapped++;
+  pr->swapstab_free = e->hnext;
+
+  e->vaddr = va;
+  bucket = &(pr->swapstab_hash[STAB_HASH(va)]);
+  e->hnext = *bucket;
+  *bucket = e;
+  return e;
+}
+
+// Release a swapstab entry and its reference to the swap slot.
+void swapstab_remove(struct proc *pr, struct swapstab_page_entry *e)
+{
+  struct swapstab_page_entry **pp;
+
+  for (pp = &(pr->swapstab_hash[STAB_HASH(e->vaddr)]); *pp != e; pp = &((*pp)->hnext))
+    if (*pp == 0)
+      panic("swapstab_remove");
+  *pp = e->hnext;
+
+  swapslot_free(e->slot);
+  pr->num_swapped--;
+  e->vaddr = SLOT_USABLE;
+  e->hnext = pr->swapstab_free;
+  pr->swapstab_free = e;
+}
+
 // Copy swap table (mem, swapped) from srcproc to dstproc.
 // Don't preserve relative location in memory swap table.
 // Returns 0 on success, otherwise -1.
 int copy_stab(struct proc *dstproc, struct proc *srcproc)
 {
-  // Copy memory swap table.
-  memstab_clear(dstproc);
-  dstproc->num_mem_entries = srcproc->num_mem_entries;
-  dstproc->memqueue_head = 0;
-  dstproc->memqueue_tail = 0;
+  struct memstab_page_entry *cursrcent, *e;
 
-  struct memstab_page *curpg = dstproc->memstab_head;
-  int curpos = 0;
-  struct memstab_page_entry *cursrcent = srcproc->memqueue_head;
-  struct memstab_page_entry *olddstent = 0;
-
-  if (cursrcent != 0)
-    dstproc->memqueue_head = &(curpg->entries[curpos]);
-  while (cursrcent != 0)
+  // Copy memory swap table, oldest page first, so that
+  // the memqueue keeps its order.
+  memstab_clear(dstproc);
+  for (cursrcent = srcproc->memqueue_tail; cursrcent != 0; cursrcent = cursrcent->prev)
   {
-    if (olddstent != 0)
-      olddstent->next = &(curpg->entries[curpos]);
-    curpg->entries[curpos].prev = olddstent;
-    olddstent = &(curpg->entries[curpos]);
-    curpg->entries[curpos].vaddr = cursrcent->vaddr;
-
-    cursrcent = cursrcent->next;
-    curpos++;
-
-    if (curpos == NUM_MEMSTAB_PAGE_ENTRIES)
-    {
-      curpg = curpg->next;
-      curpos = 0;
-    }
+    if ((e = memstab_insert(dstproc, cursrcent->vaddr)) == 0)
+      return -1;
+    e->superpage = cursrcent->superpage;
   }
-  dstproc->memqueue_tail = olddstent;
+  dstproc->num_mem_entries = srcproc->num_mem_entries;
 
-  // Copy swapped swap table.
+  // Copy swapped swap table. The child shares the swap slots
+  // of the parent.
   int i;
-  struct swapstab_page *srccurpg, *dstcurpg;
-  while (srcproc->num_swapstab_pages > dstproc->num_swapstab_pages)
-  {
-    if (swapstab_growpage(dstproc) == 0)
-      return -1;
-  }
+  struct swapstab_page *srccurpg;
+  struct swapstab_page_entry *srcent;
 
-  srccurpg = srcproc->swapstab_head;
-  dstcurpg = dstproc->swapstab_head;
-  while (srccurpg != 0)
+  swapstab_clear(dstproc);
+  if (srcproc->num_swapped == 0)
+    return 0;
+  for (srccurpg = srcproc->swapstab_head; srccurpg != 0; srccurpg = srccurpg->next)
   {
     for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
-      dstcurpg->entries[i] = srccurpg->entries[i];
-    dstcurpg = dstcurpg->next;
-    srccurpg = srccurpg->next;
+    {
+      srcent = &(srccurpg->entries[i]);
+      if (srcent->vaddr == SLOT_USABLE)
+        continue;
+      if (swapstab_insert(dstproc, srcent->vaddr, srcent->slot) == 0)
+        return -1;
+      swapslot_dup(srcent->slot);
+    }
   }
 
   return 0;
@@ -337,20 +629,23 @@ found:
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
 
-  // Set up mem swap table if not exist.
-  // Otherwise clear it.
-  if (p->memstab_head == 0)
-  {
-    if ((p->memstab_head = memstab_alloc()) == 0)
-      return 0;
-  }
-  else
-    memstab_clear(p);
-
-  // Set up data for page swapping.
-  p->num_mem_entries = 0;
-  p->memqueue_head = 0;
-  p->memqueue_tail = 0;
+  // The swap tables are empty, and are only allocated
+  // once the process records or swaps out a page.
+  memstab_clear(p);
+  swapstab_clear(p);
+
+  p->execip = 0;
+  p->nexecsegs = 0;
+  p->swap_policy = SWAP_POLICY;
+  p->num_swapins = 0;
+  p->num_swapfaults = 0;
+  p->ra_next = 0;
+  p->ra_window = 0;
+  p->ws_size = 0;
+  p->rss_limit = NUM_MEMSTAB_ENTRIES_CAPACITY;
+  p->aged = 0;
+  p->preempted_user = 0;
+  p->swapping = 0;
 
   // Set up data for memory sharing.
   int i;
@@ -398,6 +693,234 @@ userinit(void)
   release(&ptable.lock);
 }
 
+static struct proc *kswapdproc;
+static uint kswapd_aged;  // ticks when kswapd last aged the processes
+
+// Can kswapd stop p and work on its pages? Processes preempted
+// in user mode hold no locks and are not using their page tables.
+// Sleeping processes are switched out too, and the kernel code they
+// sleep in does not keep pointers to their pages across the sleep,
+// nor sleeps with memstab out of step with p->pgdir (exec records
+// the new image only once it has switched to it). They are also the
+// idle ones, with the coldest memory.
+// The caller holds ptable.lock.
+static int
+stoppable(struct proc *p)
+{
+  if(p->swapping)
+    return 0;
+  return p->state == SLEEPING || (p->state == RUNNABLE && p->preempted_user);
+}
+
+// Pick a process kswapd may swap out pages from and mark it, so that
+// it is not run meanwhile. A sleeping process woken up meanwhile
+// stays out of the scheduler until kswapd is done, see scheduler().
+// If over_limit is set, only processes above their resident limit are
+// taken. Start looking after *next.
+static struct proc*
+kswapd_victim(struct proc **next, int over_limit)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = *next; p < &ptable.proc[NPROC]; p++){
+    if(!stoppable(p))
+      continue;
+    if(p == kswapdproc || p->num_mem_entries <= RSS_MIN)
+      continue;
+    if(over_limit && p->num_mem_entries <= p->rss_limit)
+      continue;
+    p->swapping = 1;
+    release(&ptable.lock);
+    *next = p + 1;
+    return p;
+  }
+  release(&ptable.lock);
+  *next = p;
+  return 0;
+}
+
+// Age the pages of the processes that are not running, see
+// age_pages() in vm.c. Sleeping processes never take a timer tick in
+// user mode, so without this their working sets would never shrink.
+static void
+kswapd_age(void)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    acquire(&ptable.lock);
+    if(!stoppable(p) || p->num_mem_entries == 0 || ticks - p->aged < WS_AGE_TICKS){
+      release(&ptable.lock);
+      continue;
+    }
+    p->swapping = 1;
+    release(&ptable.lock);
+
+    age_pages(p);
+
+    acquire(&ptable.lock);
+    p->swapping = 0;
+    release(&ptable.lock);
+  }
+}
+
+// Page reclaimer. Every WS_AGE_TICKS ticks, it ages the processes
+// that are not running. When free memory falls below FREE_LOW, it
+// frees pages until there are FREE_HIGH free pages. Unused pages of the
+// page cache are freed first, then idle pages of the buffer cache.
+// Then processes above their resident limit are trimmed, and then
+// cold pages are taken from all processes. Pages still being written
+// to swap count as free.
+static void
+kswapd(void)
+{
+  struct proc *p, *next;
+  int over_limit, n, freed;
+
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  for(;;){
+    acquire(&ptable.lock);
+    while(get_num_free_pages() >= FREE_LOW && ticks - kswapd_aged < WS_AGE_TICKS)
+      sleep(kswapdproc, &ptable.lock);
+    release(&ptable.lock);
+
+    if(ticks - kswapd_aged >= WS_AGE_TICKS){
+      kswapd_aged = ticks;
+      kswapd_age();
+    }
+    if(get_num_free_pages() >= FREE_LOW)
+      continue;
+
+    // Program pages no process maps any more go first, then pages
+    // the buffer cache took while memory was plentiful.
+    freed = pcache_reclaim(FREE_HIGH - get_num_free_pages());
+    freed += bcache_shrink(FREE_HIGH - get_num_free_pages());
+    for(over_limit = 1; over_limit >= 0; over_limit--){
+      next = ptable.proc;
+      while(get_num_free_pages() + swap_pending() < FREE_HIGH &&
+            (p = kswapd_victim(&next, over_limit)) != 0){
+        n = TRIM_BATCH;
+        if(over_limit && p->num_mem_entries - p->rss_limit < n)
+          n = p->num_mem_entries - p->rss_limit;
+        freed += reclaim_pages(p, n);
+
+        acquire(&ptable.lock);
+        p->swapping = 0;
+        release(&ptable.lock);
+      }
+    }
+    // Pages being swapped out are freed once the disk has them.
+    swap_sync();
+
+    // Nothing to take right now, wait for processes to be preempted.
+    if(freed == 0){
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+// Start the kswapd kernel thread.
+void
+kswapdinit(void)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kswapdinit");
+  p->context->eip = (uint)kswapd;
+  safestrcpy(p->name, "kswapd", sizeof(p->name));
+  kswapdproc = p;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
+// Wake kswapd up if free memory is low, or if it is time to age the
+// processes. Called on timer ticks.
+void
+kswapd_wake(void)
+{
+  if(kswapdproc == 0 ||
+     (get_num_free_pages() >= FREE_LOW && ticks - kswapd_aged < WS_AGE_TICKS))
+    return;
+  acquire(&ptable.lock);
+  wakeup1(kswapdproc);
+  release(&ptable.lock);
+}
+
+// Same-page merger. Every KSM_INTERVAL ticks, stops the processes
+// preempted in user mode and merges identical pages among them,
+// looking at KSM_PAGES pages in all. Every process is looked at in
+// the same window of addresses, so that copies of one program line
+// up, and the window moves on every round.
+static void
+ksmd(void)
+{
+  struct proc *p, *procs[NPROC];
+  uint va, top, start;
+  int i, n, npages;
+
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  va = 0;
+  for(;;){
+    acquire(&tickslock);
+    start = ticks;
+    while(ticks - start < KSM_INTERVAL)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    n = 0;
+    top = 0;
+    acquire(&ptable.lock);
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->state != RUNNABLE || !p->preempted_user || p->swapping)
+        continue;
+      p->swapping = 1;
+      procs[n++] = p;
+      if(p->sz > top)
+        top = p->sz;
+    }
+    release(&ptable.lock);
+    if(n == 0)
+      continue;
+
+    npages = KSM_PAGES / n > 0 ? KSM_PAGES / n : 1;
+    ksm_scan(procs, n, va, npages);
+    va += npages * PGSIZE;
+    if(va >= top)
+      va = 0;
+
+    acquire(&ptable.lock);
+    for(i = 0; i < n; i++)
+      procs[i]->swapping = 0;
+    release(&ptable.lock);
+  }
+}
+
+// Start the ksmd kernel thread.
+void
+ksmdinit(void)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("ksmdinit");
+  p->context->eip = (uint)ksmd;
+  safestrcpy(p->name, "ksmd", sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -445,13 +968,25 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+
+  // Copy data for swapping. The tables grow with kalloc, so this
+  // can fail; the child then shares no swap slots with us.
+  if(copy_stab(np, curproc) == -1){
+    swapstab_clear(np);
+    stab_free(np);
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = curproc->sz;
   np->parent = curproc;
   np->stack_size = curproc->stack_size;
   *np->tf = *curproc->tf;
 
-  // Copy data for swapping.
-  np->num_mem_entries = curproc->num_mem_entries;
+  np->swap_policy = curproc->swap_policy;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -460,33 +995,15 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  if(curproc->execip)
+    np->execip = idup(curproc->execip);
+  np->nexecsegs = curproc->nexecsegs;
+  memmove(np->execsegs, curproc->execsegs, sizeof(np->execsegs));
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
 
-  swapalloc(np);
-  char buf[PGSIZE / 2] = "";
-  int offset = 0;
-  int nread = 0;
-
-  if (kstrcmp(curproc->name, "init") != 0 && kstrcmp(curproc->name, "sh") != 0)
-  {
-    // Copy swap file.
-    offset = 0;
-    nread = 0;
-    while ((nread = swapread(curproc, buf, offset, PGSIZE / 2)) != 0)
-    {
-      if (swapwrite(np, buf, offset, nread) == -1)
-        panic("[ERROR] Copying swapfile in fork().");
-      offset += nread;
-    }
-  }
-
-  // Copy data for swapping.
-  if (copy_stab(np, curproc) == -1)
-    return -1;
-
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
@@ -517,10 +1034,6 @@ exit(void)
     }
   }
 
-  // Remove swap file.
-  if (swapdealloc(curproc) != 0)
-    panic("[ERROR] Remove swap file error.");
-
   // Clear unreleased share memory.
   int i;
   for (i = 0;i<NUM_SHM_PER_PROC;i++)
@@ -535,8 +1048,16 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->execip)
+    iput(curproc->execip);
   end_op();
   curproc->cwd = 0;
+  curproc->execip = 0;
+  curproc->nexecsegs = 0;
+
+  // Free swap slots. This is done after the last sleep, since kswapd
+  // may swap out pages of a sleeping process.
+  swapstab_clear(curproc);
 
   acquire(&ptable.lock);
 
@@ -581,6 +1102,7 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
+        stab_free(p);
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -624,7 +1146,7 @@ scheduler(void)
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || p->swapping)
         continue;
 
       // Switch to chosen process.  It is the process's job
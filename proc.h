@@ -34,41 +34,48 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-// Every memory swap table page has 340 entries to fit into a page. (4088 Bytes in total.)
-#define NUM_MEMSTAB_PAGE_ENTRIES 340
-// Every swapped swap table page has 1022 entries to fit into a page. (4096 Bytes in total.)
-#define NUM_SWAPSTAB_PAGE_ENTRIES 1022
-
-#define SWAPSTAB_PAGE_OFFSET (NUM_SWAPSTAB_PAGE_ENTRIES * PGSIZE)
-
-// A swap table has 25 table pages, so the number of in-memory pages is limited to 8500,
-// which is 33.2MB. All swap tables take 6.25MB.
+// Every memory swap table page has 204 entries (NUM_MEMSTAB_PAGE_ENTRIES in param.h)
+// to fit into a page. (4088 Bytes in total.)
+// Every swapped swap table page has 340 entries to fit into a page. (4088 Bytes in total.)
+#define NUM_SWAPSTAB_PAGE_ENTRIES 340
+
+// A swap table has at most NUM_MEMSTAB_PAGES (42) table pages, so the number of in-memory
+// pages is limited to NUM_MEMSTAB_ENTRIES_CAPACITY (8568), which is 33.5MB. Both are in
+// param.h, so that user tests can size themselves from them.
+// Table pages are allocated as the process grows.
 // Number of swapped stab pages is unlimited, it will grow dynamically and is limited by USERTOP.
-#define NUM_MEMSTAB_PAGES 25
-
-#define NUM_MEMSTAB_ENTRIES_CAPACITY (NUM_MEMSTAB_PAGE_ENTRIES * NUM_MEMSTAB_PAGES)
-
-// Max bytes in a single swap file.
-#define SWAPFILE_LIMIT 65536
 
-#define MAX_SWAPFILES 6
+// Both swap tables are indexed by a hash table of page virtual addresses,
+// which takes exactly one page of bucket pointers.
+#define STAB_HASH_SIZE (PGSIZE / sizeof(void *))
+#define STAB_HASH(va) ((((uint)(va)) >> PGSHIFT) & (STAB_HASH_SIZE - 1))
 
+// An unused entry is on the free slot stack (through next),
+// a used one is on the memqueue (through next and prev).
 struct memstab_page_entry
 {
   char *vaddr;
   struct memstab_page_entry *next;
   struct memstab_page_entry *prev;
+  struct memstab_page_entry *hnext;   // Next entry in the same hash bucket.
+  ushort age;                         // Aging counter, see age_pages().
+  uchar readahead;                    // Read ahead and not accessed yet.
+  uchar superpage;                    // Stands for the whole 4MB superpage at vaddr.
 };
 
-// This is the entry of a page of the swapped swap table. It only contains a virtual address,
-// So the pages in memory and swapfile should be in the same order.
+// This is the entry of a page of the swapped swap table.
+// The page is kept in a slot of the swap area (see swap.c).
+// An unused entry is on the free slot stack, a used one is in a
+// hash bucket; both go through hnext.
 struct swapstab_page_entry
 {
   char *vaddr;
+  struct swapstab_page_entry *hnext;
+  int slot;
 };
 
 // This is part of a table to record pages in memory (stab means 'swap table').
-// 2 pointer takes 16 bytes, and the array takes 170x24 bytes (4080 in total),
+// 2 pointer takes 8 bytes, and the array takes 204x20 bytes (4088 in total),
 // so it can be filled into a single page perfectly.
 
 // By linking many of these pages, we can have a large swap table in kernel memory.
@@ -87,6 +94,16 @@ struct swapstab_page
   struct swapstab_page_entry entries[NUM_SWAPSTAB_PAGE_ENTRIES];
 };
 
+// A loadable segment of the program, read in from the program
+// file a page at a time, on first touch. See execpage() in vm.c.
+struct execseg
+{
+  uint vaddr;   // Start, page aligned
+  uint memsz;   // Size in memory
+  uint off;     // Offset in the program file
+  uint filesz;  // Bytes read from the file, the rest is zeros
+};
+
 // Per-process state
 #define NUM_SHM_PER_PROC 4
 
@@ -103,6 +120,9 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file, for pages not read in yet
+  int nexecsegs;               // Segments of the program
+  struct execseg execsegs[NEXECSEG];
   char name[16];               // Process name (debugging)
 
   // Now the stack is growing from top to bottom,
@@ -113,16 +133,31 @@ struct proc {
 
   int num_mem_entries;         // How many entries are saved in memstab. 
   int num_swapstab_pages;      // How many pages does swapstab_low have.
+  int num_memstab_pages;       // How many pages does memstab have.
+  int num_swapped;             // How many pages are in the swap area.
+  int swap_policy;             // Page replacement policy, SWAP_FIFO, SWAP_CLOCK or SWAP_WSCLOCK.
+  int num_swapins;             // How many pages have been swapped in.
+  int num_swapfaults;          // How many page faults have swapped pages in.
+  uint ra_next;                // Swap faults at this address are sequential.
+  int ra_window;               // How many pages to read ahead of the next sequential swap fault.
+  int ws_size;                 // Pages accessed in the last 8 working set scans.
+  int rss_limit;               // How many pages may stay in memory.
+  uint aged;                   // Value of ticks at the last working set scan.
+  int preempted_user;          // Preempted by the timer in user mode, holds no locks.
+  int swapping;                // kswapd or ksmd is working on the pages, do not run.
 
-  struct file *swapfile[MAX_SWAPFILES]; // Swap file for memory.
 
   struct memstab_page *memstab_head;
   struct memstab_page *memstab_tail;
   struct memstab_page_entry *memqueue_head;
   struct memstab_page_entry *memqueue_tail;
+  struct memstab_page_entry *memstab_free;    // Stack of unused entries.
+  struct memstab_page_entry **memstab_hash;   // Entries by vaddr.
 
   struct swapstab_page *swapstab_head;
   struct swapstab_page *swapstab_tail;
+  struct swapstab_page_entry *swapstab_free;  // Stack of unused entries.
+  struct swapstab_page_entry **swapstab_hash; // Entries by vaddr.
 
   int shmem_sigs[NUM_SHM_PER_PROC];
 };
@@ -0,0 +1,45 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Memory swap table benchmark.
+// Grow the process to 30MB one page at a time, touching each page,
+// then shrink it back, so that every page is recorded in and removed
+// from the memstab.
+
+#define PGSIZE 4096
+#define NPAGES (30 * 1024 * 1024 / PGSIZE)
+
+int main()
+{
+    int i, start, grow, shrink;
+    char *p;
+
+    printf(1, "================================\n");
+    printf(1, "Swap table benchmark started.\n");
+    printf(1, "Free pages before: %d\n", nfpgs());
+
+    start = uptime();
+    for (i = 0; i < NPAGES; i++)
+    {
+        if ((p = sbrk(PGSIZE)) == (char *)-1)
+        {
+            printf(1, "sbrk failed after %d pages.\n", i);
+            exit();
+        }
+        *p = 1;
+    }
+    grow = uptime() - start;
+
+    start = uptime();
+    for (i = 0; i < NPAGES; i++)
+        sbrk(-PGSIZE);
+    shrink = uptime() - start;
+
+    printf(1, "Grow %d pages: %d ticks.\n", NPAGES, grow);
+    printf(1, "Free %d pages: %d ticks.\n", NPAGES, shrink);
+    printf(1, "Free pages after: %d\n", nfpgs());
+    printf(1, "Swap table benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
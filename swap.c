@@ -0,0 +1,263 @@
+// Swap area.
+//
+// Swapped out pages live in NSWAPSLOTS page-sized slots on disk
+// SWAPDEV, starting at sector SWAPSTART, past the kernel. Slots are
+// handed out from a bitmap, in runs of consecutive slots, so that a
+// batch of pages moves with one disk request. Pages are read and
+// written straight to the disk, bypassing the buffer cache and the log.
+//
+// Before a page goes to disk, it is offered to the compressed swap
+// pool in zswap.c, which keeps it in memory under the same slot.
+//
+// A fork child shares the swapped-out pages of its parent, so slots
+// are reference counted. A shared slot is never written; a process
+// that swaps the page in drops its reference instead.
+//
+// Swap-out does not wait for the disk. Each run of pages goes out in
+// a request of its own from swapio, and the pages are freed when it
+// finishes. The disk driver keeps a later request for the same slots
+// behind it, so a swap-in of a page being written reads it back.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define SECTOR_SIZE   512
+#define SLOTSECTS     (PGSIZE/SECTOR_SIZE)
+
+struct {
+  struct spinlock lock;
+  uint bitmap[NSWAPSLOTS/32];  // bit set if the slot is in use
+  ushort ref[NSWAPSLOTS];      // swapstab entries holding the slot
+  int nfree;
+  int hint;                    // slot to start looking from
+} swapmap;
+
+// A swap-out request in flight.
+struct swapreq {
+  struct buf b;
+  char *pages[SWAPBATCH];
+  int busy;
+};
+
+struct {
+  struct spinlock lock;
+  struct swapreq req[NSWAPIO];
+  int pending;  // pages being written
+} swapio;
+
+void
+swapinit(void)
+{
+  initlock(&swapmap.lock, "swapmap");
+  swapmap.nfree = NSWAPSLOTS;
+  initlock(&swapio.lock, "swapio");
+}
+
+// Allocate a run of up to *n consecutive swap slots, so that they
+// can be written in one request. Takes the first run of *n free
+// slots, or else the longest run there is, and sets *n to its
+// length. Returns the first slot, or -1 if the swap area is full.
+int
+swapslot_alloc(int *n)
+{
+  int i, s, len, best, bestlen;
+
+  acquire(&swapmap.lock);
+  best = -1;
+  bestlen = len = 0;
+  for(i = 0; i < NSWAPSLOTS && bestlen < *n; i++){
+    s = (swapmap.hint + i) % NSWAPSLOTS;
+    if(s == 0)
+      len = 0;  // runs do not wrap around
+    if(swapmap.bitmap[s/32] == 0xffffffff){
+      len = 0;
+      i += 31 - s%32;
+      continue;
+    }
+    if(swapmap.bitmap[s/32] & (1 << (s%32))){
+      len = 0;
+      continue;
+    }
+    if(++len > bestlen){
+      bestlen = len;
+      best = s - len + 1;
+    }
+  }
+  if(best < 0){
+    release(&swapmap.lock);
+    return -1;
+  }
+  for(s = best; s < best + bestlen; s++){
+    swapmap.bitmap[s/32] |= 1 << (s%32);
+    swapmap.ref[s] = 1;
+  }
+  swapmap.nfree -= bestlen;
+  swapmap.hint = (best + bestlen) % NSWAPSLOTS;
+  release(&swapmap.lock);
+  *n = bestlen;
+  return best;
+}
+
+// Take another reference to a slot in use.
+void
+swapslot_dup(int slot)
+{
+  if(slot < 0 || slot >= NSWAPSLOTS)
+    panic("swapslot_dup");
+  acquire(&swapmap.lock);
+  if(swapmap.ref[slot] == 0)
+    panic("swapslot_dup: not in use");
+  swapmap.ref[slot]++;
+  release(&swapmap.lock);
+}
+
+// Drop a reference to a slot, and free it with the last one.
+void
+swapslot_free(int slot)
+{
+  if(slot < 0 || slot >= NSWAPSLOTS)
+    panic("swapslot_free");
+  acquire(&swapmap.lock);
+  if(swapmap.ref[slot] == 0)
+    panic("swapslot_free: not in use");
+  if(--swapmap.ref[slot] == 0){
+    // Drop the pool copy before the slot can be reused.
+    release(&swapmap.lock);
+    zswap_invalidate(slot);
+    acquire(&swapmap.lock);
+    swapmap.bitmap[slot/32] &= ~(1 << (slot%32));
+    swapmap.nfree++;
+  }
+  release(&swapmap.lock);
+}
+
+// Transfer n pages to or from the n slots from slot on, in one
+// disk request. The pages need not be contiguous in memory.
+void
+swaprw(int slot, char **pages, int n, int write)
+{
+  struct buf b;
+
+  if(slot < 0 || n <= 0 || n > SWAPBATCH || slot + n > NSWAPSLOTS)
+    panic("swaprw");
+
+  memset(&b, 0, sizeof(b));
+  initsleeplock(&b.lock, "swap");
+  acquiresleep(&b.lock);
+  b.flags = B_RAW | (write ? B_DIRTY : 0);
+  b.dev = SWAPDEV;
+  b.pages = (uchar**)pages;
+  b.sector = SWAPSTART + slot*SLOTSECTS;
+  b.nsect = n*SLOTSECTS;
+  iderw(&b);
+  releasesleep(&b.lock);
+}
+
+// Read n pages from the n slots from slot on. Pages held by the
+// compressed pool are copied from there, the others are read with
+// one request per run of consecutive slots.
+void
+swapread(int slot, char **pages, int n)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j + 1){
+    for(j = i; j < n && zswap_load(slot + j, pages[j]) != 0; j++)
+      ;
+    if(j > i)
+      swaprw(slot + i, pages + i, j - i, 0);
+  }
+}
+
+// Called by ideintr when a swap-out request is finished.
+static void
+swapwrite_done(struct buf *b)
+{
+  struct swapreq *r = (struct swapreq*)b;
+  int i, n = b->nsect/SLOTSECTS;
+
+  for(i = 0; i < n; i++)
+    kfree(r->pages[i]);
+  releasesleep(&b->lock);
+
+  acquire(&swapio.lock);
+  r->busy = 0;
+  swapio.pending -= n;
+  wakeup(&swapio);
+  release(&swapio.lock);
+}
+
+// Start writing n pages to the n slots from slot on, in one disk
+// request. The pages are freed once written.
+static void
+swapwrite_start(int slot, char **pages, int n)
+{
+  struct swapreq *r;
+
+  acquire(&swapio.lock);
+  for(;;){
+    for(r = swapio.req; r < swapio.req + NSWAPIO && r->busy; r++)
+      ;
+    if(r < swapio.req + NSWAPIO)
+      break;
+    sleep(&swapio, &swapio.lock);
+  }
+  r->busy = 1;
+  swapio.pending += n;
+  release(&swapio.lock);
+
+  memset(&r->b, 0, sizeof(r->b));
+  memmove(r->pages, pages, n*sizeof(char*));
+  initsleeplock(&r->b.lock, "swap");
+  acquiresleep(&r->b.lock);
+  r->b.flags = B_RAW | B_DIRTY;
+  r->b.dev = SWAPDEV;
+  r->b.pages = (uchar**)r->pages;
+  r->b.sector = SWAPSTART + slot*SLOTSECTS;
+  r->b.nsect = n*SLOTSECTS;
+  r->b.done = swapwrite_done;
+  iderw_start(&r->b);
+}
+
+// Write n pages to the n slots from slot on, and free them. The
+// pages the compressed pool takes are freed right away, the others
+// once the disk has written them; this does not wait for that.
+void
+swapwrite(int slot, char **pages, int n)
+{
+  int i, j;
+
+  if(slot < 0 || n <= 0 || n > SWAPBATCH || slot + n > NSWAPSLOTS)
+    panic("swapwrite");
+  for(i = 0; i < n; i = j + 1){
+    for(j = i; j < n && zswap_store(slot + j, pages[j]) != 0; j++)
+      ;
+    if(j > i)
+      swapwrite_start(slot + i, pages + i, j - i);
+    if(j < n)
+      kfree(pages[j]);
+  }
+}
+
+// Wait until all swap-outs started so far are written.
+void
+swap_sync(void)
+{
+  acquire(&swapio.lock);
+  while(swapio.pending > 0)
+    sleep(&swapio, &swapio.lock);
+  release(&swapio.lock);
+}
+
+// Number of pages being swapped out, which will be free soon.
+int
+swap_pending(void)
+{
+  return swapio.pending;
+}
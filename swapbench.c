@@ -0,0 +1,217 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Fork, exec, page swap latency and swap readahead benchmark.
+
+#define PGSIZE 4096
+#define NFORKS 200
+#define NEXECS 100
+#define NSWAPS 256
+#define NSWAPFORKS 20
+#define NRESCAN 1024
+
+// Fork and reap NFORKS children, return elapsed ticks.
+int bench_fork(void)
+{
+    int i, pid, start;
+
+    start = uptime();
+    for (i = 0; i < NFORKS; i++)
+    {
+        if ((pid = fork()) < 0)
+        {
+            printf(1, "Fork failed.\n");
+            exit();
+        }
+        if (pid == 0)
+            exit();
+        wait();
+    }
+    return uptime() - start;
+}
+
+// Fork children that exec this program with an argument, so that
+// it exits right away, return elapsed ticks.
+int bench_exec(void)
+{
+    int i, pid, start;
+    char *argv[] = {"swapbench", "exit", 0};
+
+    start = uptime();
+    for (i = 0; i < NEXECS; i++)
+    {
+        if ((pid = fork()) < 0)
+        {
+            printf(1, "Fork failed.\n");
+            exit();
+        }
+        if (pid == 0)
+        {
+            exec("swapbench", argv);
+            printf(1, "Exec failed.\n");
+            exit();
+        }
+        wait();
+    }
+    return uptime() - start;
+}
+
+// Grow past the memstab capacity so that the first NSWAPS pages are
+// swapped out, then touch them again. Without pressure, the top of
+// the heap is freed first, so that the swap-ins find free room.
+// Runs in a child, return elapsed ticks of the swap-ins.
+int bench_swap(int pressure)
+{
+    int i, fd[2], start, ticks;
+    char *base, *p;
+
+    pipe(fd);
+    if (fork() == 0)
+    {
+        close(fd[0]);
+        swappolicy(SWAP_FIFO);
+        base = sbrk(0);
+        for (i = 0; i < NUM_MEMSTAB_ENTRIES_CAPACITY + NSWAPS; i++)
+        {
+            if ((p = sbrk(PGSIZE)) == (char *)-1)
+            {
+                printf(1, "sbrk failed after %d pages.\n", i);
+                exit();
+            }
+            *p = 1;
+        }
+        if (!pressure)
+            sbrk(-2 * NSWAPS * PGSIZE);
+
+        start = uptime();
+        for (i = 0; i < NSWAPS; i++)
+            base[i * PGSIZE]++;
+        ticks = uptime() - start;
+        write(fd[1], &ticks, sizeof(ticks));
+        exit();
+    }
+    close(fd[1]);
+    if (read(fd[0], &ticks, sizeof(ticks)) != sizeof(ticks))
+        ticks = -1;
+    close(fd[0]);
+    wait();
+    return ticks;
+}
+
+// Grow past the memstab capacity so that nswapped pages are swapped
+// out, then fork NSWAPFORKS times. Runs in a child, return elapsed
+// ticks of the forks.
+int bench_swapfork(int nswapped)
+{
+    int i, fd[2], start, ticks;
+
+    pipe(fd);
+    if (fork() == 0)
+    {
+        close(fd[0]);
+        for (i = 0; i < NUM_MEMSTAB_ENTRIES_CAPACITY + nswapped; i++)
+        {
+            char *p = sbrk(PGSIZE);
+            if (p == (char *)-1)
+            {
+                printf(1, "sbrk failed after %d pages.\n", i);
+                exit();
+            }
+            *p = 1;
+        }
+
+        start = uptime();
+        for (i = 0; i < NSWAPFORKS; i++)
+        {
+            if (fork() == 0)
+                exit();
+            wait();
+        }
+        ticks = uptime() - start;
+        write(fd[1], &ticks, sizeof(ticks));
+        exit();
+    }
+    close(fd[1]);
+    if (read(fd[0], &ticks, sizeof(ticks)) != sizeof(ticks))
+        ticks = -1;
+    close(fd[0]);
+    wait();
+    return ticks;
+}
+
+// Swap out the first NRESCAN pages of the heap, free the top of the
+// heap to make room, then touch the swapped out pages again, in
+// address order if forward is set, otherwise in reverse. Runs in a
+// child, r gets elapsed ticks, swap faults and pages swapped in.
+void bench_rescan(int forward, int r[3])
+{
+    int i, fd[2], faults, pages;
+    char *base, *p;
+
+    pipe(fd);
+    if (fork() == 0)
+    {
+        close(fd[0]);
+        swappolicy(SWAP_FIFO);
+        base = sbrk(0);
+        for (i = 0; i < NUM_MEMSTAB_ENTRIES_CAPACITY + NRESCAN; i++)
+        {
+            if ((p = sbrk(PGSIZE)) == (char *)-1)
+            {
+                printf(1, "sbrk failed after %d pages.\n", i);
+                exit();
+            }
+            *p = 1;
+        }
+        sbrk(-2 * NRESCAN * PGSIZE);
+
+        faults = swapfaults();
+        pages = swapins();
+        r[0] = uptime();
+        for (i = 0; i < NRESCAN; i++)
+            base[(forward ? i : NRESCAN - 1 - i) * PGSIZE]++;
+        r[0] = uptime() - r[0];
+        r[1] = swapfaults() - faults;
+        r[2] = swapins() - pages;
+        write(fd[1], r, 3 * sizeof(int));
+        exit();
+    }
+    close(fd[1]);
+    if (read(fd[0], r, 3 * sizeof(int)) != 3 * sizeof(int))
+        r[0] = r[1] = r[2] = -1;
+    close(fd[0]);
+    wait();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        exit();
+
+    printf(1, "================================\n");
+    printf(1, "Swap latency benchmark started.\n");
+
+    printf(1, "%d forks: %d ticks.\n", NFORKS, bench_fork());
+    printf(1, "%d execs: %d ticks.\n", NEXECS, bench_exec());
+    printf(1, "%d swap-ins at capacity: %d ticks.\n", NSWAPS, bench_swap(1));
+    printf(1, "%d swap-ins below capacity: %d ticks.\n", NSWAPS, bench_swap(0));
+
+    int r[3];
+    bench_rescan(1, r);
+    printf(1, "%d pages rescanned in order: %d ticks, %d faults, %d pages read.\n",
+           NRESCAN, r[0], r[1], r[2]);
+    bench_rescan(0, r);
+    printf(1, "%d pages rescanned in reverse: %d ticks, %d faults, %d pages read.\n",
+           NRESCAN, r[0], r[1], r[2]);
+
+    int nswapped;
+    for (nswapped = 0; nswapped <= 2048; nswapped = nswapped ? nswapped * 4 : 128)
+        printf(1, "%d forks with %d pages swapped out: %d ticks.\n",
+               NSWAPFORKS, nswapped, bench_swapfork(nswapped));
+
+    printf(1, "Swap latency benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
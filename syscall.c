@@ -124,6 +124,14 @@ extern int sys_mkshm(void);
 extern int sys_rmshm(void);
 extern int sys_rdshm(void);
 extern int sys_wtshm(void);
+extern int sys_frag(void);
+extern int sys_swappolicy(void);
+extern int sys_swapins(void);
+extern int sys_swapfaults(void);
+extern int sys_zswapmax(void);
+extern int sys_zswapstat(void);
+extern int sys_ksmsaved(void);
+extern int sys_bcachestat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -151,7 +159,15 @@ static int (*syscalls[])(void) = {
 [SYS_mkshm]   sys_mkshm,
 [SYS_rmshm]   sys_rmshm,
 [SYS_rdshm]   sys_rdshm,
-[SYS_wtshm]   sys_wtshm
+[SYS_wtshm]   sys_wtshm,
+[SYS_frag]    sys_frag,
+[SYS_swappolicy] sys_swappolicy,
+[SYS_swapins] sys_swapins,
+[SYS_swapfaults] sys_swapfaults,
+[SYS_zswapmax] sys_zswapmax,
+[SYS_zswapstat] sys_zswapstat,
+[SYS_ksmsaved] sys_ksmsaved,
+[SYS_bcachestat] sys_bcachestat,
 };
 
 void
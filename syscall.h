@@ -25,3 +25,11 @@
 #define SYS_rmshm  24
 #define SYS_rdshm  25
 #define SYS_wtshm  26
+#define SYS_frag   27
+#define SYS_swappolicy 28
+#define SYS_swapins 29
+#define SYS_swapfaults 30
+#define SYS_zswapmax 31
+#define SYS_zswapstat 32
+#define SYS_ksmsaved 33
+#define SYS_bcachestat 34
@@ -282,15 +282,28 @@ create(char *path, short type, short major, short minor)
     iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto bad;
   }
 
+  // dp may be out of extents.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto bad;
 
   iunlockput(dp);
 
   return ip;
+
+bad:
+  // Free the new inode, and take back the link of its "..".
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  if(type == T_DIR){
+    dp->nlink--;
+    iupdate(dp);
+  }
+  iunlockput(dp);
+  return 0;
 }
 
 int
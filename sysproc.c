@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "zswap.h"
+#include "bcache.h"
 
 int
 sys_fork(void)
@@ -52,8 +54,13 @@ sys_sbrk(void)
   if(argint(0, &n) < 0)
     return -1;
   addr = curproc->sz;
-  if (n < 0 && growproc(n) < 0)
-    return -1;
+  if (n < 0)
+  {
+    // growproc has already shrunk sz.
+    if (growproc(n) < 0)
+      return -1;
+    return addr;
+  }
 
   // Avoid heap grows higher than stack.
   if (curproc->sz + n > USERTOP - curproc->stack_size - PGSIZE)
@@ -103,6 +110,74 @@ int sys_nfpgs(void)
   return get_num_free_pages();
 }
 
+// Frames freed by same-page merging so far.
+int sys_ksmsaved(void)
+{
+  return get_ksm_saved();
+}
+
+int sys_frag(void)
+{
+  return get_frag_index();
+}
+
+// Set the page replacement policy of this process.
+// Returns the old policy, or -1 if the policy is unknown.
+int sys_swappolicy(void)
+{
+  int policy, old;
+  struct proc *curproc = myproc();
+
+  if (argint(0, &policy) < 0)
+    return -1;
+  if (policy != SWAP_FIFO && policy != SWAP_CLOCK && policy != SWAP_WSCLOCK)
+    return -1;
+  old = curproc->swap_policy;
+  curproc->swap_policy = policy;
+  return old;
+}
+
+int sys_swapins(void)
+{
+  return myproc()->num_swapins;
+}
+
+int sys_swapfaults(void)
+{
+  return myproc()->num_swapfaults;
+}
+
+// Set the size cap of the compressed swap pool, in pages.
+// Returns the old cap.
+int sys_zswapmax(void)
+{
+  int n;
+
+  if (argint(0, &n) < 0 || n < 0)
+    return -1;
+  return zswap_setmax(n);
+}
+
+int sys_zswapstat(void)
+{
+  struct zswapstat *st;
+
+  if (argptr(0, (void *)&st, sizeof(*st)) < 0)
+    return -1;
+  zswap_getstat(st);
+  return 0;
+}
+
+int sys_bcachestat(void)
+{
+  struct bcachestat *st;
+
+  if (argptr(0, (void *)&st, sizeof(*st)) < 0)
+    return -1;
+  bcache_getstat(st);
+  return 0;
+}
+
 int sys_mkshm(void)
 {
   int sig;
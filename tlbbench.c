@@ -0,0 +1,52 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// TLB-sensitive benchmark: sweep a 16MB heap region with a page
+// stride, so every access touches a different page. With superpages
+// (SUPERPAGES in param.h) the region needs 4 TLB entries instead of
+// 4096. Build the kernel with SUPERPAGES set to 0 and 1 to compare.
+
+#define MB (1024 * 1024)
+#define REGION (16 * MB)
+#define PAGE 4096
+#define ROUNDS 200
+
+int main()
+{
+    char *p;
+    uint pad;
+    int i, r, start, ticks, sum;
+
+    printf(1, "================================\n");
+    printf(1, "TLB benchmark started.\n");
+
+    // Align the region to 4MB so it can be mapped with superpages.
+    p = sbrk(0);
+    pad = (4 * MB - (uint)p % (4 * MB)) % (4 * MB);
+    sbrk(pad);
+    p = sbrk(REGION);
+    if (p == (char *)-1)
+    {
+        printf(1, "sbrk failed.\n");
+        exit();
+    }
+
+    printf(1, "Free pages before touching: %d\n", nfpgs());
+    start = uptime();
+    for (i = 0; i < REGION; i += PAGE)
+        p[i] = 1;
+    printf(1, "First touch: %d ticks, free pages %d\n", uptime() - start, nfpgs());
+
+    sum = 0;
+    start = uptime();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < REGION; i += PAGE)
+            sum += p[i];
+    ticks = uptime() - start;
+    printf(1, "%d page-stride sweeps of %d MB: %d ticks (sum %d)\n", ROUNDS, REGION / MB, ticks, sum);
+
+    printf(1, "TLB benchmark finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -57,6 +57,7 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      kswapd_wake();
     }
     lapiceoi();
     break;
@@ -104,11 +105,22 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
+  // Keep the working set estimate of a user process up to date.
+  // No locks are held when the tick comes from user mode.
+  if(myproc() && myproc()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_TIMER && (tf->cs&3) == DPL_USER)
+    wstick();
+
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
+  // A process preempted in user mode may have its pages swapped
+  // out by kswapd while it waits.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER){
+    myproc()->preempted_user = (tf->cs&3) == DPL_USER;
     yield();
+    myproc()->preempted_user = 0;
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
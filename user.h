@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct zswapstat;
+struct bcachestat;
 
 // system calls
 int fork(void);
@@ -24,10 +26,18 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int nfpgs(void);
+int ksmsaved(void);
 int mkshm(int);
 int rmshm(int);
 int rdshm(int, char*);
 int wtshm(int, char*);
+int frag(void);
+int swappolicy(int);
+int swapins(void);
+int swapfaults(void);
+int zswapmax(int);
+int zswapstat(struct zswapstat*);
+int bcachestat(struct bcachestat*);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -184,6 +184,12 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Number of 512-byte writes in the big files test: a whole file of
+// the classic 512-byte layout. With larger blocks MAXFILE is far
+// bigger than the disk, but this many still reaches the doubly
+// indirect blocks.
+#define NBIG (11 + 128 + 128*128)
+
 void
 writetest1(void)
 {
@@ -197,7 +203,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +223,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NBIG - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
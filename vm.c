@@ -5,11 +5,15 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "elf.h"
 #include "traps.h"
 #include "debugsw.h"
 
-#define SWAP_BUF_SIZE (PGSIZE / 4)    // Buffer size when swap.
+#define SPGORDER 10                   // kalloc_order() order of a superpage.
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -33,16 +37,80 @@ seginit(void)
   lgdt(c->gdt, sizeof(c->gdt));
 }
 
+// Replace the superpage mapped at va in pgdir with a page table
+// holding the same 1024 mappings, so that single pages in it can be
+// changed. Returns 0 on success, -1 if out of memory.
+static int
+splitsuperpage(pde_t *pgdir, uint va)
+{
+  pde_t *pde = &pgdir[PDX(va)];
+  pte_t *pgtab;
+  uint pa, flags, i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i * PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  // The old translations are still valid, but make sure the
+  // TLB does not hold both sizes for the same address.
+  if(myproc() && myproc()->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Split the superpage of p at va, and its memstab entry into one
+// entry per page. The pages take the place of the superpage in the
+// memqueue, lowest address first to be swapped out.
+// Returns 0 on success, -1 if out of memory.
+static int
+splituser(struct proc *p, uint va)
+{
+  struct memstab_page_entry *e, *pe;
+  uint base = SPGROUNDDOWN(va);
+  int i;
+
+  e = memstab_lookup(p, (char*)base);
+  if(e != 0 && e->superpage && memstab_reserve(p, NPTENTRIES - 1) < 0)
+    return -1;
+  if(splitsuperpage(p->pgdir, base) < 0)
+    return -1;
+  if(e == 0 || !e->superpage)
+    return 0;
+  e->superpage = 0;
+  for(i = 1; i < NPTENTRIES; i++){
+    pe = memstab_insert(p, (char*)(base + i * PGSIZE));
+    pe->age = e->age;
+    memstab_moveafter(p, pe, e);
+  }
+  return 0;
+}
+
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
+// A user superpage covering va is split into 4KB pages first,
+// even if alloc is 0, since callers may modify the PTE.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
+  struct proc *p = myproc();
   pde_t *pde;
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS){
+    if((uint)va >= KERNBASE)
+      panic("walkpgdir: kernel superpage");
+    // The current process has the superpage in memstab too.
+    if(p != 0 && p->pgdir == pgdir){
+      if(splituser(p, (uint)va) < 0)
+        return 0;
+    } else if(splitsuperpage(pgdir, (uint)va) < 0)
+      return 0;
+  }
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -83,6 +151,34 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages(), but map every 4MB-aligned part of the range
+// that is at least 4MB long with a superpage instead of a page table.
+static int
+mapsuperpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, last, n;
+
+  a = PGROUNDDOWN((uint)va);
+  last = PGROUNDDOWN(((uint)va) + size - 1);
+  for(;;){
+    if(a % SPGSIZE == 0 && pa % SPGSIZE == 0 && last - a >= SPGSIZE - PGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      n = SPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)a, PGSIZE, pa, perm) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+    if(a + n - PGSIZE == last)
+      break;
+    a += n;
+    pa += n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -100,6 +196,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Parts of these ranges that are 4MB-aligned are mapped with
+// superpages, which saves page table pages and TLB entries.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -119,23 +218,20 @@ static struct kmap {
 };
 
 // Set up kernel part of a page table.
+// The kernel half of every page directory is a copy of the kernel
+// half of kpgdir, so all processes share one set of kernel page
+// tables and only the page directory itself is allocated here.
+// kpgdir is built once by kvmalloc() and never changes afterwards.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE) * sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -144,7 +240,17 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapsuperpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                     (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -198,6 +304,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
 // Load a program segment into pgdir.  addr must be page-aligned
 // and the pages from addr to addr+sz must already be mapped.
+// Used for the segments exec() does not demand-page.
 int
 loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 {
@@ -220,115 +327,316 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
   return 0;
 }
 
-// Find a usable slot and record it using linear search.
-void fifo_record(char *va, struct proc *curproc)
+// Take a free slot from the free slot stack and record the page.
+// Returns 0 if the memstab cannot grow, out of memory.
+struct memstab_page_entry *fifo_record(char *va, struct proc *curproc)
 {
-  int curpos = 0;
-  struct memstab_page *curpg = curproc->memstab_head;
-
-  while (curpg != 0)
-  {
-    for (curpos = 0; curpos < NUM_MEMSTAB_PAGE_ENTRIES; curpos++)
-    {
-      if (curpg->entries[curpos].vaddr == SLOT_USABLE)
-      {
-        curpg->entries[curpos].vaddr = va;
-        curpg->entries[curpos].next = curproc->memqueue_head;
-        if (curproc->memqueue_head == 0)
-          curproc->memqueue_head = curproc->memqueue_tail = &(curpg->entries[curpos]);
-        else
-        {
-          curproc->memqueue_head->prev = &(curpg->entries[curpos]);
-          curproc->memqueue_head = &(curpg->entries[curpos]);
-        }
-        return;
-      }
-    }
-
-    curpg = curpg->next;
-  }
-
-  panic("[ERROR] No free slot in memory.");
+  return memstab_insert(curproc, va);
 }
 
-// Add a new page to memstab.
-void record_page(char *va)
+// Add a new page to memstab. Returns 0 if out of memory, and the
+// caller fails like on a kalloc failure.
+struct memstab_page_entry *record_page(char *va)
 {
   struct proc *curproc = myproc();
-  fifo_record(va, curproc);
+  struct memstab_page_entry *e;
+
+  if ((e = fifo_record(va, curproc)) == 0)
+    return 0;
   curproc->num_mem_entries++;
+  return e;
 }
 
-struct memstab_page_entry *fifo_write()
+// Forget a page just recorded by record_page(), which could not be
+// mapped after all.
+static void unrecord_page(struct memstab_page_entry *e)
 {
-  struct memstab_page_entry *link, *last;
   struct proc *curproc = myproc();
 
-  link = curproc->memqueue_head;
-  if (link == 0 || link->next == 0)
-    panic("Only 0 or 1 page in memory.");
-  last = curproc->memqueue_tail;
-  if (last == 0 || last->prev == 0)
-    panic("[Error] last null!");
-  curproc->memqueue_tail = last->prev;
-  last->prev->next = 0;
-  last->prev = 0;
+  memstab_remove(curproc, e);
+  curproc->num_mem_entries--;
+}
 
-  struct swapstab_page *curpage;
-  int i = 0, pg = 0;
+// The PTE of the page recorded by e, or the PDE if e stands for
+// a superpage. Either has PTE_A set when the memory is accessed.
+static pte_t *memstab_pte(struct proc *p, struct memstab_page_entry *e)
+{
+  if (e->superpage)
+    return &p->pgdir[PDX(e->vaddr)];
+  return walkpgdir(p->pgdir, (void *)e->vaddr, 0);
+}
 
-  curpage = curproc->swapstab_head;
+// Pick the page to be swapped out. FIFO takes the oldest page.
+// CLOCK gives the oldest page a second chance if it has been
+// accessed since it was last looked at: PTE_A is cleared and the
+// page goes to the head of memqueue. The callers flush the TLB,
+// so later accesses set PTE_A again.
+// WSCLOCK does the same for pages in the working set (nonzero age),
+// but looks at no more than the whole memqueue once. If every page
+// is in the working set, it takes the one with the lowest age.
+// A superpage picked is split, and its pages are taken one by one.
+// Returns 0 if there is no memory to split it.
+static struct memstab_page_entry *select_victim(struct proc *curproc)
+{
+  struct memstab_page_entry *last, *victim, *best = 0;
+  pte_t *pte;
+  int n;
 
-  while (curpage != 0)
+  for (n = 0; ; n++)
   {
-    for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
-      if (curpage->entries[i].vaddr == SLOT_USABLE)
+    last = curproc->memqueue_tail;
+    if (last == 0 || last->prev == 0)
+      panic("Only 0 or 1 page in memory.");
+    victim = 0;
+    if (curproc->swap_policy == SWAP_FIFO)
+      victim = last;
+    else if (curproc->swap_policy == SWAP_WSCLOCK && n >= curproc->num_mem_entries && best != 0)
+      victim = best;
+    else
+    {
+      pte = memstab_pte(curproc, last);
+      if (pte != 0 && (*pte & PTE_A))
       {
-        curpage->entries[i].vaddr = last->vaddr;
-        if (swapwrite(curproc, (char *)PTE_ADDR(last->vaddr), (pg * SWAPSTAB_PAGE_OFFSET) + (i * PGSIZE), PGSIZE) == 0)
-          return 0;
-        goto SUCCESS;
+        *pte &= ~PTE_A;
+        last->age |= 0x80;
+        last->readahead = 0;
       }
-    curpage = curpage->next;
-    pg++;
-  }
-
-  swapstab_growpage(curproc);
-  curpage = curproc->swapstab_tail;
+      else if (curproc->swap_policy == SWAP_CLOCK || last->age == 0)
+        victim = last;
+    }
 
-  for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
-    if (curpage->entries[i].vaddr == SLOT_USABLE)
+    if (victim != 0)
     {
-      curpage->entries[i].vaddr = last->vaddr;
-      if (swapwrite(curproc, (char *)PTE_ADDR(last->vaddr), (pg * SWAPSTAB_PAGE_OFFSET) + (i * PGSIZE), PGSIZE) == 0)
+      if (!victim->superpage)
+        return victim;
+      if (splituser(curproc, (uint)victim->vaddr) < 0)
         return 0;
-      goto SUCCESS;
+      continue;
     }
+    if (best == 0 || last->age < best->age)
+      best = last;
+    memstab_movehead(curproc, last);
+  }
+}
 
-  panic("[ERROR] SLOT OUT.");
-
+// Swap out up to n pages of p chosen by select_victim, with one
+// write to a run of consecutive swap slots. The pages go to the slots
+// in address order, so that a sequential swap-in can read them back
+// with one request too. p is either the current process or a process
+// kswapd has stopped. Returns the number of pages swapped out.
+int fifo_write(struct proc *p, int n)
+{
+  struct memstab_page_entry *last;
+  char *va[SWAPBATCH], *mem[SWAPBATCH], *v;
+  int ra[SWAPBATCH], slot, i, j, r;
   pte_t *pte;
 
-SUCCESS:
-  // Free the page pointed by last - it has been swapped out and can be reused.
-  pte = walkpgdir(curproc->pgdir, (void *)last->vaddr, 0);
-  if (!(*pte))
-    panic("[ERROR] [fifo_write] PTE empty.");
-  kfree((char *)(P2V_WO(PTE_ADDR(*pte))));
-  *pte = PTE_W | PTE_U | PTE_PG;
+  if (n > SWAPBATCH)
+    n = SWAPBATCH;
+  if (n > p->num_mem_entries - 1)
+    n = p->num_mem_entries - 1;
+  if (n <= 0 || (slot = swapslot_alloc(&n)) < 0)
+    return 0;
+
+  // Take the victims out of memstab, sorted by address.
+  for (i = 0; i < n; i++)
+  {
+    if ((last = select_victim(p)) == 0)
+    {
+      for (j = i; j < n; j++)
+        swapslot_free(slot + j);
+      n = i;
+      break;
+    }
+    v = last->vaddr;
+    r = last->readahead;
+    memstab_remove(p, last);
+    p->num_mem_entries--;
+    for (j = i; j > 0 && va[j - 1] > v; j--)
+    {
+      va[j] = va[j - 1];
+      ra[j] = ra[j - 1];
+    }
+    va[j] = v;
+    ra[j] = r;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    pte = walkpgdir(p->pgdir, va[i], 0);
+    if (pte == 0 || !(*pte & PTE_P))
+      panic("[ERROR] [fifo_write] PTE empty.");
+    if (swapstab_insert(p, va[i], slot + i) == 0)
+    {
+      // Out of memory for swapstab, keep the rest in memory.
+      // Their memstab entries were freed above, so this cannot fail.
+      for (j = i; j < n; j++)
+      {
+        swapslot_free(slot + j);
+        if (fifo_record(va[j], p) == 0)
+          panic("fifo_write: memstab");
+        p->num_mem_entries++;
+      }
+      n = i;
+      break;
+    }
+    // Write through the kernel mapping, p's page table may not be loaded.
+    mem[i] = P2V(PTE_ADDR(*pte));
+    // A page read ahead and never used: read less ahead next time.
+    if (ra[i] && !(*pte & PTE_A))
+      p->ra_window /= 2;
+    *pte = PTE_W | PTE_U | PTE_PG;
+  }
+  if (n == 0)
+    return 0;
   // Refresh page dir.
-  lcr3(V2P(curproc->pgdir));
+  if (p == myproc())
+    lcr3(V2P(p->pgdir));
 
-  // Return the freed slot.
-  return last;
+  // The pages are freed once they are written, see swap_sync.
+  swapwrite(slot, mem, n);
+  return n;
 }
 
-// Swap out a page from memstab to swapstab.
-struct memstab_page_entry *write_page(char *va)
+// Swap out a batch of pages of p from memstab to swapstab.
+// Returns 0 if any page was swapped out, otherwise -1.
+int write_page(struct proc *p)
 {
   if (SHOW_PAGE_SWAPOUT_INFO)
-    cprintf("Swapping out a page.\n");
-  return fifo_write();
+    cprintf("Swapping out pages.\n");
+  return fifo_write(p, SWAPBATCH) > 0 ? 0 : -1;
+}
+
+// Swap out up to n pages of p, which kswapd has stopped.
+// Returns the number of pages swapped out.
+int reclaim_pages(struct proc *p, int n)
+{
+  int i, m;
+
+  for (i = 0; i < n && p->num_mem_entries > RSS_MIN; i += m)
+  {
+    m = n - i;
+    if (m > p->num_mem_entries - RSS_MIN)
+      m = p->num_mem_entries - RSS_MIN;
+    if ((m = fifo_write(p, m)) == 0)
+      break;
+  }
+  return i;
+}
+
+// Same-page merging, driven by ksmd in proc.c.
+#define KSM_HASH 64
+
+struct ksmpage
+{
+  uint sum;
+  uint pa;
+  pte_t *pte;
+  struct ksmpage *next;
+};
+
+static struct ksmpage ksmpages[KSM_PAGES];
+static struct ksmpage *ksmhash[KSM_HASH];
+static uint ksm_saved;  // Frames freed by merging so far.
+
+// Checksum of a page. Sets *zero if the page is all zeros.
+static uint ksm_sum(uint *w, int *zero)
+{
+  uint sum = 0, any = 0;
+  int i;
+
+  for (i = 0; i < PGSIZE / sizeof(uint); i++)
+  {
+    sum = sum * 31 + w[i];
+    any |= w[i];
+  }
+  *zero = (any == 0);
+  return sum;
+}
+
+// Merge identical pages of the n processes in procs, which ksmd has
+// stopped, looking at the npages pages from va on in each of them.
+// A page equal to one seen before is mapped read-only to the same
+// frame, and the first write takes a private copy again. A page of
+// zeros is mapped to the zero page, and leaves memstab like a lazy
+// page that has only been read. Returns the number of frames freed.
+int ksm_scan(struct proc **procs, int n, uint va, int npages)
+{
+  struct ksmpage *k;
+  struct memstab_page_entry *e;
+  struct proc *p;
+  pte_t *pte;
+  uint a, pa, sum;
+  int i, nk, zero, freed;
+
+  nk = 0;
+  freed = 0;
+  memset(ksmhash, 0, sizeof(ksmhash));
+  for (i = 0; i < n; i++)
+  {
+    p = procs[i];
+    for (a = va; a < va + npages * PGSIZE && a < p->sz; a += PGSIZE)
+    {
+      // Superpages are left alone, walkpgdir would split them.
+      if (!(p->pgdir[PDX(a)] & PTE_P) || (p->pgdir[PDX(a)] & PTE_PS))
+      {
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      pte = walkpgdir(p->pgdir, (char *)a, 0);
+      if (!(*pte & PTE_P) || !(*pte & PTE_U))
+        continue;
+      pa = PTE_ADDR(*pte);
+      if (is_zero_page(pa) || ((*pte & PTE_W) && get_page_ref(pa) > 1))
+        continue;
+
+      sum = ksm_sum((uint *)P2V(pa), &zero);
+      if (zero)
+      {
+        if ((e = memstab_lookup(p, (char *)a)) != 0)
+        {
+          memstab_remove(p, e);
+          p->num_mem_entries--;
+        }
+        freed += get_page_ref(pa) == 1;
+        kfree(P2V(pa));
+        *pte = V2P(get_zero_page()) | PTE_P | PTE_U;
+        continue;
+      }
+
+      for (k = ksmhash[sum % KSM_HASH]; k != 0; k = k->next)
+        if (k->sum == sum && (k->pa == pa || memcmp(P2V(k->pa), P2V(pa), PGSIZE) == 0))
+          break;
+      if (k == 0)
+      {
+        if (nk < KSM_PAGES)
+        {
+          k = &ksmpages[nk++];
+          k->sum = sum;
+          k->pa = pa;
+          k->pte = pte;
+          k->next = ksmhash[sum % KSM_HASH];
+          ksmhash[sum % KSM_HASH] = k;
+        }
+        continue;
+      }
+      if (k->pa == pa)
+        continue;
+
+      *k->pte &= ~PTE_W;
+      incr_page_ref(k->pa);
+      freed += get_page_ref(pa) == 1;
+      kfree(P2V(pa));
+      *pte = k->pa | (PTE_FLAGS(*pte) & ~PTE_W);
+    }
+  }
+  ksm_saved += freed;
+  return freed;
+}
+
+uint get_ksm_saved(void)
+{
+  return ksm_saved;
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
@@ -342,10 +650,11 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
   struct proc* curproc = myproc();
+  struct memstab_page_entry *e;
   int stack_reserved = USERTOP - curproc->stack_size - PGSIZE;
-
-  uint newpage_allocated = 1;
-  struct memstab_page_entry *l;
+  // The pages of a page table the process does not run on yet, the
+  // one exec builds, are recorded by exec, see recorduvm().
+  int record = (pgdir == curproc->pgdir);
 
   // Check args.
   if (curproc->stack_grow == 1)
@@ -371,24 +680,13 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   for(; a < newsz; a += PGSIZE)
   {
     // Check if we have enough space to put the page in memory.
-    if (curproc->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY)
+    // If not, swap out the oldest page to make room.
+    if (record && curproc->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY &&
+        write_page(curproc) != 0)
     {
-      // Swap out page at oldsz.
-      if ((l = write_page((char *)a)) == 0)
-        panic("[ERROR] Cannot write to swapfile.");
-
-      l->vaddr = (char *)a;
-      l->next = curproc->memqueue_head;
-      if (curproc->memqueue_head == 0)
-        curproc->memqueue_head = curproc->memqueue_tail = l;
-      else
-      {
-        curproc->memqueue_head->prev = l;
-        curproc->memqueue_head = l;
-      }
-      // No new page in memory will be used
-      // (A page will be reused), mark that.
-      newpage_allocated = 0;
+      cprintf("allocuvm out of swap space\n");
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
     }
 
     mem = kalloc();
@@ -398,12 +696,19 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       return 0;
     }
 
-    if (newpage_allocated)
-      record_page((char *)a);
+    e = 0;
+    if(record && (e = record_page((char *)a)) == 0){
+      cprintf("allocuvm out of memory (3)\n");
+      deallocuvm(pgdir, newsz, oldsz);
+      kfree(mem);
+      return 0;
+    }
 
     memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
+      if(e)
+        unrecord_page(e);
       deallocuvm(pgdir, newsz, oldsz);
       kfree(mem);
       return 0;
@@ -412,6 +717,19 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Drop the references to the 1024 pages of the superpage
+// mapped by *pde and clear the mapping.
+static void
+freesuperpage(pde_t *pde)
+{
+  uint pa, i;
+
+  pa = PTE_ADDR(*pde);
+  for (i = 0; i < NPTENTRIES; i++)
+    kfree(P2V(pa + i * PGSIZE));
+  *pde = 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -421,8 +739,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   pte_t *pte;
   uint a, pa;
-  int i;
   struct proc* curproc = myproc();
+  struct memstab_page_entry *slot;
+  struct swapstab_page_entry *ent;
 
   if(newsz >= oldsz)
     return oldsz;
@@ -430,6 +749,19 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   a = PGROUNDUP(newsz);
   for (; a < oldsz; a += PGSIZE)
   {
+    // A whole superpage goes away at once, with its memstab entry.
+    if ((pgdir[PDX(a)] & PTE_PS) && a % SPGSIZE == 0 && a + SPGSIZE <= oldsz)
+    {
+      if (curproc->pgdir == pgdir && (slot = memstab_lookup(curproc, (char *)a)) != 0)
+      {
+        memstab_remove(curproc, slot);
+        curproc->num_mem_entries -= NPTENTRIES;
+      }
+      freesuperpage(&pgdir[PDX(a)]);
+      a += SPGSIZE - PGSIZE;
+      continue;
+    }
+
     pte = walkpgdir(pgdir, (char *)a, 0);
     if (!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -439,45 +771,11 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if (pa == 0)
         panic("kfree");
 
-      // If the page is in memstab, clear it.
-      if (curproc->pgdir == pgdir)
+      // If the page is in memstab, clear it. Lazily allocated
+      // pages are not recorded.
+      if (curproc->pgdir == pgdir && (slot = memstab_lookup(curproc, (char *)a)) != 0)
       {
-        struct memstab_page *curpg = curproc->memstab_head;
-        struct memstab_page_entry *slot = 0;
-
-        while (curpg != 0)
-        {
-          for (i = 0; i < NUM_MEMSTAB_PAGE_ENTRIES; i++)
-            if (curpg->entries[i].vaddr == (char *)(a))
-            {
-              slot = &(curpg->entries[i]);
-              break;
-            }
-
-          if (slot == 0)
-            curpg = curpg->next;
-          else
-            break;
-        }
-
-        panic("Should have a slot.");
-        slot->vaddr = SLOT_USABLE;
-        if (curproc->memqueue_head == slot)
-        {
-          if (slot->next != 0)
-            slot->next->prev = 0;
-          curproc->memqueue_head = slot->next;
-        }
-        else
-        {
-          struct memstab_page_entry *l = curproc->memqueue_head;
-          while (l->next != slot)
-            l = l->next;
-          l->next->next->prev = l;
-          l->next = slot->next;
-        }
-        slot->next = 0;
-        slot->prev = 0;
+        memstab_remove(curproc, slot);
         curproc->num_mem_entries--;
       }
 
@@ -488,31 +786,18 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     // Maybe the page is not presented by is in swapfile.
     else if ((*pte & PTE_PG) && curproc->pgdir == pgdir)
     {
-      struct swapstab_page* curpg;
-      int i;
-
-      curpg = curproc->swapstab_head;
-      while(curpg!=0)
-      {
-        for(i = 0;i<NUM_SWAPSTAB_PAGE_ENTRIES;i++)
-        {
-          if(curpg->entries[i].vaddr == (char*)a)
-          {
-            curpg->entries[i].vaddr = SLOT_USABLE;
-            return newsz;
-          }
-        }
-        curpg = curpg->next;
-      }
-
-      panic("[ERROR] deallocuvm (entry not found (swap)).");
+      if ((ent = swapstab_lookup(curproc, (char *)a)) == 0)
+        panic("[ERROR] deallocuvm (entry not found (swap)).");
+      swapstab_remove(curproc, ent);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel page tables are shared with
+// kpgdir (see setupkvm) and are left alone.
 void
 freevm(pde_t *pgdir)
 {
@@ -521,8 +806,8 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -530,6 +815,47 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Number of user pages mapped in pgdir.
+int
+countuvm(pde_t *pgdir)
+{
+  pte_t *pgtab;
+  int i, j, n;
+
+  n = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    if(pgdir[i] & PTE_PS)
+      panic("countuvm: superpage");
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if(pgtab[j] & PTE_P)
+        n++;
+  }
+  return n;
+}
+
+// Record the user pages of the current process in memstab, once
+// exec has switched it to the page table allocuvm() filled without
+// recording. exec has reserved the entries with memstab_reserve().
+void
+recorduvm(void)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  pte_t *pgtab;
+  int i, j;
+
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if((pgtab[j] & PTE_P) && record_page((char*)PGADDR(i, j, 0)) == 0)
+        panic("recorduvm");
+  }
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -553,7 +879,7 @@ copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa, i, flags;
+  uint pa, i, j, flags;
 
   if((d = setupkvm()) == 0)
     return 0;
@@ -561,6 +887,25 @@ copyuvm(pde_t *pgdir, uint sz)
   // Copy code section, data section and heap section.
   for (i = PGSIZE; i < sz; i += PGSIZE)
   {
+    // Lazily allocated heap may not have a page table yet.
+    if (!(pgdir[PDX(i)] & PTE_P))
+    {
+      i = SPGROUNDDOWN(i) + SPGSIZE - PGSIZE;
+      continue;
+    }
+
+    // Share a superpage as a whole, without splitting it.
+    if (pgdir[PDX(i)] & PTE_PS)
+    {
+      pgdir[PDX(i)] &= ~PTE_W;
+      d[PDX(i)] = pgdir[PDX(i)];
+      pa = PTE_ADDR(pgdir[PDX(i)]);
+      for (j = 0; j < NPTENTRIES; j++)
+        incr_page_ref(pa + j * PGSIZE);
+      i = SPGROUNDDOWN(i) + SPGSIZE - PGSIZE;
+      continue;
+    }
+
     if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0)
       panic("copyuvm: pte should exist");
 
@@ -664,6 +1009,188 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 // Blank page.
 
 
+// Map the 4MB-aligned region around va with one superpage if all
+// of it lies in the heap and none of it has been touched yet.
+// The superpage is recorded in memstab as one entry, which counts
+// for all of its pages. It is split when it is picked to be swapped
+// out. Returns 0 on success, -1 if a superpage cannot be used here.
+static int
+lazysuperpage(struct proc *p, uint va)
+{
+  uint base = SPGROUNDDOWN(va);
+  struct memstab_page_entry *e;
+  struct execseg *s;
+  char *mem;
+  uint i;
+
+  if (base == 0 || base + SPGSIZE > PGROUNDUP(p->sz) || (p->pgdir[PDX(base)] & PTE_P))
+    return -1;
+  if (p->num_mem_entries + NPTENTRIES > NUM_MEMSTAB_ENTRIES_CAPACITY)
+    return -1;
+  for (s = p->execsegs; s < p->execsegs + p->nexecsegs; s++)
+    if (base < s->vaddr + s->memsz && base + SPGSIZE > s->vaddr)
+      return -1;
+  if ((e = memstab_insert(p, (char *)base)) == 0)
+    return -1;
+  if ((mem = kalloc_order(SPGORDER)) == 0)
+  {
+    memstab_remove(p, e);
+    return -1;
+  }
+  memset(mem, 0, SPGSIZE);
+  e->superpage = 1;
+  p->num_mem_entries += NPTENTRIES;
+
+  // Give every page its own reference, so that the superpage
+  // can later be split and its pages freed one by one.
+  for (i = 1; i < NPTENTRIES; i++)
+    incr_page_ref(V2P(mem) + i * PGSIZE);
+
+  p->pgdir[PDX(base)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  return 0;
+}
+
+// Set [*start, *end) to the part of the page at va that comes from
+// the file in segment s. Returns 0 if there is none.
+static int
+segfile(struct execseg *s, uint va, uint *start, uint *end)
+{
+  *start = va > s->vaddr ? va : s->vaddr;
+  *end = va + PGSIZE < s->vaddr + s->filesz ? va + PGSIZE : s->vaddr + s->filesz;
+  return *start < *end;
+}
+
+// Read the page at va of the program of p in from the program file,
+// if va is in one of its segments. Returns 1 if it is not, 0 once the
+// page is mapped, and -1 if out of memory.
+// A page with file contents from one segment goes through the page
+// cache and is mapped read-only, so that every process running the
+// program shares it until it writes to it. Such a page is not
+// recorded in memstab until copy on write gives it a private frame.
+static int
+execpage(struct proc *p, uint va)
+{
+  struct execseg *s, *seg;
+  struct memstab_page_entry *e;
+  uint start, end, off, len;
+  char *mem;
+  int nseg, locked;
+
+  va = PGROUNDDOWN(va);
+  seg = 0;
+  nseg = 0;
+  for(s = p->execsegs; s < p->execsegs + p->nexecsegs; s++){
+    if(va < s->vaddr + s->memsz && va + PGSIZE > s->vaddr){
+      seg = s;
+      nseg++;
+    }
+  }
+  if(nseg == 0)
+    return 1;
+
+  off = len = 0;
+  if(nseg == 1 && va - seg->vaddr < seg->filesz){
+    off = seg->off + va - seg->vaddr;
+    len = seg->filesz - (va - seg->vaddr) < PGSIZE ? seg->filesz - (va - seg->vaddr) : PGSIZE;
+    if((mem = pcache_get(p->execip->dev, p->execip->inum, off, len)) != 0)
+      goto map;
+  }
+
+  // Reading the page in may sleep, which a fault taken with a
+  // spinlock held must not do. The kernel does not touch user
+  // memory under spinlocks: pipes and the console copy through a
+  // kernel buffer outside their locks, and the stat calls
+  // (filestat, zswap_getstat, bcache_getstat) fill a local and copy
+  // it out after release. System call arguments, strings included,
+  // are read with no lock held.
+  if(mycpu()->ncli > 0)
+    panic("execpage: spinlock held");
+  if(len == 0 && p->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY && write_page(p) != 0)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  // A page with nothing from the file, of .bss or past it, is all
+  // zeros, and the inode is not locked for it.
+  for(s = p->execsegs; s < p->execsegs + p->nexecsegs; s++)
+    if(segfile(s, va, &start, &end))
+      break;
+  if(s == p->execsegs + p->nexecsegs)
+    goto map;
+
+  // Locking the program inode here is only safe if no other inode
+  // lock is held and no log operation is open: fileread(),
+  // filewrite() and filestat() read in the pages they transfer with
+  // execprefault() first. The fault may still come from a read of
+  // the program file itself, which has the inode locked already.
+  locked = holdingsleep(&p->execip->lock);
+  if(!locked)
+    ilock(p->execip);
+  for(s = p->execsegs; s < p->execsegs + p->nexecsegs; s++){
+    if(segfile(s, va, &start, &end) &&
+       readi(p->execip, mem + start - va, s->off + start - s->vaddr, end - start) != end - start)
+      break;
+  }
+  // writei() drops the cached pages of the file with the inode
+  // locked, so the page is cached before the lock is released, or a
+  // write in between would leave a stale copy in the cache. Only a
+  // fault that took the lock itself, in order, fills the cache. If
+  // the lock was already held the fault comes from a transfer on
+  // the program file itself, perhaps a writei() part way through,
+  // so the page is only mapped.
+  if(s == p->execsegs + p->nexecsegs && len > 0 && !locked)
+    pcache_add(p->execip->dev, p->execip->inum, off, len, mem);
+  if(!locked)
+    iunlock(p->execip);
+  if(s < p->execsegs + p->nexecsegs){
+    kfree(mem);
+    return -1;
+  }
+
+map:
+  e = 0;
+  if(len == 0 && (e = record_page((char*)va)) == 0){
+    kfree(mem);
+    return -1;
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), len > 0 ? PTE_U : PTE_W|PTE_U) < 0){
+    if(e)
+      unrecord_page(e);
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Read in the pages of [va, va+n) of the current process that are
+// still only in its program file, see execpage(). Called before a
+// file system lock is taken for a transfer to or from user memory,
+// so that execpage() never locks the program inode under another
+// inode's lock or inside a log operation. Pages read in stay out of
+// execpage(): if they are swapped out they come back with
+// swappage(), which takes no inode lock. Returns -1 if out of memory.
+int
+execprefault(uint va, uint n)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a;
+
+  if(p->nexecsegs == 0)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    if(p->pgdir[PDX(a)] & PTE_PS)
+      continue;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte != 0 && (*pte & (PTE_P|PTE_PG)))
+      continue;
+    if(execpage(p, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 //todo Refactor this messy code.
 void pagefault(uint err_code)
 {
@@ -682,7 +1209,7 @@ void pagefault(uint err_code)
   {
     // Used by swapping.
     pte_t* pte = &curproc->pgdir[PDX(va)];
-    if(((*pte) & PTE_P) != 0)
+    if(((*pte) & PTE_P) != 0 && ((*pte) & PTE_PS) == 0)
     {
       // If the page is swapped out, swap it in.
       if(((uint*)PTE_ADDR(P2V(*pte)))[PTX(va)] & PTE_PG) 
@@ -719,10 +1246,48 @@ void pagefault(uint err_code)
       return;
     }
 
+    // Program text and data are read in on first touch.
+    int r;
+    if ((r = execpage(curproc, va)) <= 0)
+    {
+      if (r < 0)
+      {
+        cprintf("Exec page in failed: Memory out. Killing process.\n");
+        curproc->killed = 1;
+      }
+      return;
+    }
+
     // Otherwise, should be heap allocation.
     if (SHOW_LAZY_ALLOCATION_INFO)
       cprintf("Lazy allocation at virt addr 0x%x.\n", va);
 
+    // A read maps the shared zero page, read-only. The first write
+    // takes a private page through copy on write below. The zero
+    // page takes no memory, so it is not recorded in memstab.
+    if (!(err_code & PGFLT_WR))
+    {
+      char *zero = get_zero_page();
+      if (mappages(curproc->pgdir, (char *)PGROUNDDOWN(va), PGSIZE, V2P(zero), PTE_U) < 0)
+      {
+        kfree(zero);
+        cprintf("Lazy allocation failed: Memory out (2). Killing process.\n");
+        curproc->killed = 1;
+      }
+      return;
+    }
+
+    if (SUPERPAGES && lazysuperpage(curproc, va) == 0)
+      return;
+
+    // Make room in memstab for the new page.
+    if (curproc->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY && write_page(curproc) != 0)
+    {
+      cprintf("Lazy allocation failed: Out of swap space. Killing process.\n");
+      curproc->killed = 1;
+      return;
+    }
+
     char *mem = kalloc();
     if (mem == 0)
     {
@@ -735,15 +1300,25 @@ void pagefault(uint err_code)
     va = PGROUNDDOWN(va);
     memset(mem, 0, PGSIZE);
 
+    struct memstab_page_entry *e;
+    if ((e = record_page((char *)va)) == 0)
+    {
+      kfree(mem);
+      cprintf("Lazy allocation failed: Memory out (3). Killing process.\n");
+      curproc->killed = 1;
+      return;
+    }
+
     // The first process use this page can have write permissions,
     // but once forked, copyuvm will set it permission to readonly.
     if (mappages(curproc->pgdir, (char *)va, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0)
     {
+      unrecord_page(e);
+      kfree(mem);
       cprintf("Lazy allocation failed: Memory out (2). Killing process.\n");
       curproc->killed = 1;
       return;
-    };
-  
+    }
     return;
   }
 
@@ -767,124 +1342,187 @@ void pagefault(uint err_code)
     panic("Pagefault. Already writeable.");
   }
 
-  uint pa = PTE_ADDR(*pte);
-  ushort ref = get_page_ref(pa);
+  uint pa;
   char *mem;
 
-  if (ref == 1)
-    *pte |= PTE_W;
-  else if (ref > 1)
+  // The first write to a page mapped to the zero page or from the
+  // page cache. It gets a frame of its own, which has to be
+  // recorded in memstab.
+  int record = memstab_lookup(curproc, (char *)PGROUNDDOWN(va)) == 0;
+  if (record && curproc->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY)
   {
-    if ((mem = kalloc()) == 0)
+    if (write_page(curproc) != 0)
     {
-      cprintf("Pagefault. Out of memory.");
+      cprintf("Pagefault. Out of swap space.");
       curproc->killed = 1;
       return;
     }
+    // write_page may sleep, and ksmd may remap the page meanwhile.
+    if ((pte = walkpgdir(curproc->pgdir, (void *)va, 0)) == 0 || !(*pte & PTE_P) || (*pte & PTE_W))
+      return;
+  }
+  pa = PTE_ADDR(*pte);
 
-    memmove(mem, P2V(pa), PGSIZE);
-    *pte = V2P(mem) | PTE_P | PTE_U | PTE_W;
-    decr_page_ref(pa);
+  struct memstab_page_entry *e = 0;
+  if (record && (e = record_page((char *)PGROUNDDOWN(va))) == 0)
+  {
+    cprintf("Pagefault. Out of memory.");
+    curproc->killed = 1;
+    return;
+  }
+  if ((mem = copy_cow_page(pa)) == 0)
+  {
+    if (e)
+      unrecord_page(e);
+    cprintf("Pagefault. Out of memory.");
+    curproc->killed = 1;
+    return;
   }
-  else
-    panic("Pagefault. Reference count error.");
+  *pte = V2P(mem) | PTE_P | PTE_U | PTE_W;
 }
 
-void fifo_swap(uint addr)
+// Age the pages of p. Every aging counter is shifted right,
+// and the top bit is set if the page has been accessed (PTE_A) since
+// the last scan. Pages with a nonzero counter make up the working set.
+// When free memory is low, the resident limit of the process is cut
+// down to its working set.
+// p is either the current process or a process kswapd has stopped.
+void age_pages(struct proc *p)
 {
-  int i, j;
-  char buf[SWAP_BUF_SIZE];
-  pte_t *pte_in, *pte_out;
-  struct proc *curproc = myproc();
+  struct memstab_page_entry *e;
+  pte_t *pte;
+  int ws = 0;
 
-  // Find the last record in memstab.
-  struct memstab_page_entry *link = curproc->memqueue_head;
-  struct memstab_page_entry *last;
-  if (link == 0 || link->next == 0)
-    panic("[ERROR] Only 0 or 1 pages in memory.");
-  last = curproc->memqueue_tail;
-  if (last == 0 || last->prev == 0)
-    panic("[ERROR] last null!");
-  curproc->memqueue_tail = last->prev;
-  last->prev->next = 0;
-  last->prev = 0;
-
-  // Locate the PTE of the page to be swapped out.
-  pte_in = walkpgdir(curproc->pgdir, (void *)last->vaddr, 0);
-  if (!*pte_in)
-    panic("[ERROR] A record is in memstab but not in pgdir.");
-
-  struct swapstab_page *curpg = 0;
-  struct swapstab_page_entry *ent = 0;
-  uint offset = 0;
-
-  curpg = curproc->swapstab_head;
-
-  // Find the record of the page to be swapped in in swap_pages.
-  while (curpg != 0)
+  for (e = p->memqueue_head; e != 0; e = e->next)
   {
-    for (i = 0; i < NUM_SWAPSTAB_PAGE_ENTRIES; i++)
-      if (curpg->entries[i].vaddr == (char *)PTE_ADDR(addr))
-      {
-        ent = &(curpg->entries[i]);
-        offset += i * PGSIZE;
-        break;
-      }
-
-    if (ent != 0)
-      break;
-    else
+    e->age >>= 1;
+    pte = memstab_pte(p, e);
+    if (pte != 0 && (*pte & PTE_A))
     {
-      curpg = curpg->next;
-      offset += SWAPSTAB_PAGE_OFFSET;
+      *pte &= ~PTE_A;
+      e->age |= 0x80;
+      e->readahead = 0;
     }
+    if (e->age != 0)
+      ws += e->superpage ? NPTENTRIES : 1;
   }
+  if (p == myproc())
+    lcr3(V2P(p->pgdir));
+  p->ws_size = ws;
+  p->aged = ticks;
+
+  if (get_num_free_pages() >= FREE_LOW)
+    p->rss_limit = NUM_MEMSTAB_ENTRIES_CAPACITY;
+  else if (ws + WS_SLACK < RSS_MIN)
+    p->rss_limit = RSS_MIN;
+  else if (ws + WS_SLACK < NUM_MEMSTAB_ENTRIES_CAPACITY)
+    p->rss_limit = ws + WS_SLACK;
+}
 
-  if (ent == 0)
-    panic("[ERROR] Should find a record in swapfile!");
-
-  // Perform swap.
-  ent->vaddr = last->vaddr;
-
-  pte_out = walkpgdir(curproc->pgdir, (void *)addr, 0);
-  if (!*pte_out)
-    panic("[ERROR] A record should be in pgdir!");
-  *pte_out = PTE_ADDR(*pte_in) | PTE_U | PTE_W | PTE_P;
-
-  // Real swap - read from swapfile and write to swap file.
-  for (j = 0; j < 4; j++)
-  {
-    uint loc = offset + (SWAP_BUF_SIZE * j);
-    int off = SWAP_BUF_SIZE * j;
-    memset(buf, 0, SWAP_BUF_SIZE);
-    swapread(curproc, buf, loc, SWAP_BUF_SIZE);
-    swapwrite(curproc, (char *)(P2V_WO(PTE_ADDR(*pte_in)) + off), loc, SWAP_BUF_SIZE);
-    memmove((void *)(PTE_ADDR(addr) + off), (void *)buf, SWAP_BUF_SIZE);
-  }
+// Called on every timer tick that interrupts curproc in user mode.
+// Scan the working set if WS_AGE_TICKS ticks have passed since the
+// last scan. kswapd scans the processes that are not running, and
+// swaps out the pages above the resident limit.
+void wstick(void)
+{
+  struct proc *curproc = myproc();
 
-  *pte_in = PTE_U | PTE_W | PTE_PG;
-  last->next = curproc->memqueue_head;
-  curproc->memqueue_head->prev = last;
-  curproc->memqueue_head = last;
-  last->vaddr = (char *)PTE_ADDR(addr);
+  if (ticks - curproc->aged >= WS_AGE_TICKS)
+    age_pages(curproc);
 }
 
+// Bring the swapped out page at addr back into memory. The page is
+// read straight into a free frame. Another page is swapped out first
+// only if the process has reached its memstab capacity, or if there
+// is no free frame.
+// When swap faults come in address order, up to ra_window of the
+// following pages are read in the same disk request, if they sit in
+// the following slots and there is room for them. The window grows
+// on every sequential fault, and shrinks when a page read ahead is
+// swapped out again before it has been used.
 void swappage(uint addr)
 {
   if(SHOW_SWAPPAGE_INFO)
     cprintf("[ INFO ] Swapping page for 0x%x.\n", addr);
     
-  struct proc*curproc = myproc();
+  struct proc *curproc = myproc();
+  char *va = (char *)PTE_ADDR(addr);
+  struct swapstab_page_entry *ent;
+  char *mem[SWAPBATCH];
+  pte_t *pte;
+  int slot, i, n;
+
+  if ((ent = swapstab_lookup(curproc, va)) == 0)
+    panic("[ERROR] Should find a record in swapfile!");
+  pte = walkpgdir(curproc->pgdir, va, 0);
+  if (pte == 0 || !(*pte & PTE_PG))
+    panic("[ERROR] A record should be in pgdir!");
 
-  //? Why should we do this?
-  if (kstrcmp(curproc->name, "init") == 0 || kstrcmp(curproc->name, "sh") == 0)
+  if (curproc->num_mem_entries >= NUM_MEMSTAB_ENTRIES_CAPACITY && write_page(curproc) != 0)
   {
-    curproc->num_mem_entries++;
+    cprintf("Swap in failed: Out of swap space. Killing process.\n");
+    curproc->killed = 1;
+    return;
+  }
+  if ((mem[0] = kalloc()) == 0 && write_page(curproc) == 0)
+  {
+    // The pages swapped out are freed when the disk has them.
+    swap_sync();
+    mem[0] = kalloc();
+  }
+  if (mem[0] == 0)
+  {
+    cprintf("Swap in failed: Memory out. Killing process.\n");
+    curproc->killed = 1;
     return;
   }
 
-  fifo_swap(addr);
+  curproc->num_swapfaults++;
+  if ((uint)va != curproc->ra_next)
+    curproc->ra_window = 0;
+  else if (curproc->ra_window == 0)
+    curproc->ra_window = 1;
+  else if ((curproc->ra_window *= 2) > RA_MAX)
+    curproc->ra_window = RA_MAX;
+
+  // Read ahead only into free memory, never swap out for it.
+  slot = ent->slot;
+  for (n = 1; n <= curproc->ra_window; n++)
+  {
+    if ((ent = swapstab_lookup(curproc, va + n * PGSIZE)) == 0 || ent->slot != slot + n)
+      break;
+    if (curproc->num_mem_entries + n >= NUM_MEMSTAB_ENTRIES_CAPACITY ||
+        get_num_free_pages() < FREE_LOW || (mem[n] = kalloc()) == 0)
+      break;
+  }
+
+  // The slots may be shared with fork relatives, so they are only
+  // read, and this process drops its references afterwards.
+  swapread(slot, mem, n);
+
+  // Make sure the pages can be recorded. The slots are kept until
+  // they are.
+  if (memstab_reserve(curproc, n) < 0)
+  {
+    for (i = 0; i < n; i++)
+      kfree(mem[i]);
+    cprintf("Swap in failed: Memory out (2). Killing process.\n");
+    curproc->killed = 1;
+    return;
+  }
+  for (i = 0; i < n; i++)
+  {
+    ent = swapstab_lookup(curproc, va + i * PGSIZE);
+    pte = walkpgdir(curproc->pgdir, va + i * PGSIZE, 0);
+    if (pte == 0 || !(*pte & PTE_PG))
+      panic("[ERROR] A record should be in pgdir!");
+    swapstab_remove(curproc, ent);
+    *pte = V2P(mem[i]) | PTE_P | PTE_U | PTE_W;
+    record_page(va + i * PGSIZE)->readahead = (i > 0);
+  }
+  curproc->num_swapins += n;
+  curproc->ra_next = (uint)va + n * PGSIZE;
 
   // Refresh page dir.
   lcr3(V2P(curproc->pgdir));
-}
\ No newline at end of file
+}
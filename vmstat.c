@@ -0,0 +1,35 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Print kernel memory statistics.
+// Run it repeatedly (or in a loop with an interval in ticks,
+// e.g. "vmstat 100") to watch them under load.
+
+void show(void)
+{
+    printf(1, "free pages %d, fragmentation %d%%\n", nfpgs(), frag());
+}
+
+int main(int argc, char *argv[])
+{
+    int interval;
+
+    if (argc < 2)
+    {
+        show();
+        exit();
+    }
+
+    interval = atoi(argv[1]);
+    if (interval <= 0)
+    {
+        printf(2, "usage: vmstat [interval]\n");
+        exit();
+    }
+    for (;;)
+    {
+        show();
+        sleep(interval);
+    }
+}
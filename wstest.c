@@ -0,0 +1,118 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Working set test.
+// Idle processes fill memory down to FREE_LOW free pages, then only
+// touch a small hot set now and then, and sleep in between. An active
+// process then grows past FREE_LOW and keeps touching all of its
+// pages. The kernel should trim the cold pages of the idle processes
+// instead of letting the active one thrash, so the total number of
+// swap-ins stays low. With "wstest busy", the idle processes touch
+// their hot set in a loop instead of sleeping.
+
+#define PGSIZE 4096
+#define SHARE 8000  // Pages per idle process, below the memstab capacity.
+#define MARGIN 512  // Pages left for page tables and kernel stacks.
+#define HOT 16
+#define ACTIVE 64   // How far the active process goes below FREE_LOW.
+#define DURATION 500
+#define NAP 10      // Ticks an idle process sleeps between touches.
+
+int fd[2];   // Swap-in reports.
+int rfd[2];  // Idle processes are ready.
+
+// Grow by n pages one at a time, so no superpages are used and
+// every page is recorded in memstab.
+char *grow(int n)
+{
+    char *start, *p;
+    int i;
+
+    start = sbrk(0);
+    for (i = 0; i < n; i++)
+    {
+        if ((p = sbrk(PGSIZE)) == (char *)-1)
+        {
+            printf(1, "sbrk failed after %d pages.\n", i);
+            exit();
+        }
+        *p = 1;
+    }
+    return start;
+}
+
+// Touch the first n pages from start until DURATION ticks have passed,
+// sleeping for nap ticks after every pass if nap is nonzero.
+// Report the swap-ins through the pipe.
+void work(char *start, int n, int nap)
+{
+    int i, end, swaps;
+
+    end = uptime() + DURATION;
+    while (uptime() < end)
+    {
+        for (i = 0; i < n; i++)
+            start[i * PGSIZE]++;
+        if (nap)
+            sleep(nap);
+    }
+
+    swaps = swapins();
+    write(fd[1], &swaps, sizeof(swaps));
+    exit();
+}
+
+int main(int argc, char *argv[])
+{
+    int i, nidle, pages, n, total, ready, nap;
+    char *start;
+
+    nap = argc > 1 && strcmp(argv[1], "busy") == 0 ? 0 : NAP;
+    printf(1, "================================\n");
+    printf(1, "Working set test started, idle processes %s.\n", nap ? "sleep" : "busy");
+    printf(1, "Free pages before: %d\n", nfpgs());
+
+    pipe(fd);
+    pipe(rfd);
+    nidle = 0;
+    while ((pages = nfpgs() - FREE_LOW - MARGIN) > 0)
+    {
+        if (pages > SHARE)
+            pages = SHARE;
+        if (fork() == 0)
+        {
+            start = grow(pages);
+            ready = 1;
+            write(rfd[1], &ready, sizeof(ready));
+            work(start, HOT, nap);
+        }
+        read(rfd[0], &ready, sizeof(ready));
+        nidle++;
+    }
+    printf(1, "%d idle processes, free pages: %d\n", nidle, nfpgs());
+
+    pages = nfpgs() - FREE_LOW + ACTIVE;
+    if (fork() == 0)
+    {
+        start = grow(pages);
+        work(start, pages, 0);
+    }
+
+    total = 0;
+    for (i = 0; i <= nidle; i++)
+    {
+        read(fd[0], &n, sizeof(n));
+        total += n;
+    }
+    for (i = 0; i <= nidle; i++)
+        wait();
+
+    printf(1, "Active process: %d pages.\n", pages);
+    printf(1, "Total swap-ins: %d\n", total);
+    printf(1, "Free pages after: %d\n", nfpgs());
+    printf(1, "Working set test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -130,6 +130,32 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add n to *addr. Returns the old value of *addr.
+static inline uint
+xadd(volatile uint *addr, uint n)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (n), "+m" (*addr) :
+               :
+               "cc");
+  return n;
+}
+
+// Atomically store newval into *addr if *addr equals oldval.
+// Returns the value *addr held before, so the store happened
+// if and only if the result equals oldval.
+static inline uint
+cmpxchg(volatile uint *addr, uint oldval, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (oldval) :
+               "cc");
+  return result;
+}
+
 static inline uint
 rcr2(void)
 {
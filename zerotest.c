@@ -0,0 +1,45 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Zero page test.
+// Reading NPAGES fresh heap pages should map them all to the shared
+// zero page and take no frames apart from page tables. Writing them
+// then gives each one a private frame.
+
+#define PGSIZE 4096
+#define NPAGES 1024
+
+int main(int argc, char *argv[])
+{
+    char *base;
+    int i, sum, free0, free1, free2, bad;
+
+    printf(1, "================================\n");
+    printf(1, "Zero page test started.\n");
+
+    base = sbrk(NPAGES * PGSIZE);
+    free0 = nfpgs();
+    sum = 0;
+    for (i = 0; i < NPAGES; i++)
+        sum += base[i * PGSIZE];
+    free1 = nfpgs();
+    printf(1, "Read %d pages: %d frames taken.\n", NPAGES, free0 - free1);
+
+    for (i = 0; i < NPAGES; i++)
+        base[i * PGSIZE + i % PGSIZE] = i % 127 + 1;
+    free2 = nfpgs();
+    printf(1, "Wrote %d pages: %d frames taken.\n", NPAGES, free1 - free2);
+
+    bad = sum != 0 || free0 - free1 >= NPAGES / 8 || free1 - free2 < NPAGES;
+    for (i = 0; i < NPAGES; i++)
+        if (base[i * PGSIZE + i % PGSIZE] != i % 127 + 1 || base[i * PGSIZE + (i + 1) % PGSIZE] != 0)
+            bad = 1;
+
+    if (bad)
+        printf(1, "Zero page test failed.\n");
+    else
+        printf(1, "Zero page test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
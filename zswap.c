@@ -0,0 +1,432 @@
+// Compressed swap pool.
+//
+// Pages being swapped out are first offered to a pool of compressed
+// pages in memory. A page filled with one repeated word, such as a
+// zeroed page, is kept as that word. Other pages are compressed with
+// a small LZ77 coder and packed into pool pages; a page that does not
+// shrink by at least a quarter goes to disk. A page keeps its swap
+// slot while it is in the pool, and entries are looked up by slot, so
+// a swap-in that finds its slot here does no disk I/O.
+//
+// The pool holds at most zswap.st.maxpages pages of memory. To make
+// room, the oldest entries are written back to their slots on disk.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "zswap.h"
+
+#define ZMAXLEN   (PGSIZE - PGSIZE/4)  // largest compressed page kept
+#define ZHASH     1024
+#define ZHASHSLOT(slot) ((slot) & (ZHASH-1))
+
+// Header at the start of every pool page. Entries are packed one
+// after another, and the page is freed with its last live entry.
+struct zpage {
+  uint used;  // bytes handed out, header included
+  uint live;  // entries in the page
+};
+
+struct zentry {
+  int slot;
+  uint len;              // compressed size, 0 if same-filled
+  uint fill;             // the repeated word of a same-filled page
+  char *data;            // compressed page, or the whole page in writeback
+  int writeback;         // being written back to disk
+  struct zentry *hnext;  // next in the hash bucket or the free list
+  struct zentry *prev;   // LRU list, oldest first
+  struct zentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct zentry entries[NZSWAP];
+  struct zentry *hash[ZHASH];
+  struct zentry *free;
+  struct zentry *oldest;
+  struct zentry *newest;
+  struct zpage *cur;      // page new entries are packed into
+  uchar buf[ZMAXLEN];     // compressor output
+  struct zswapstat st;
+} zswap;
+
+void
+zswapinit(void)
+{
+  int i;
+
+  initlock(&zswap.lock, "zswap");
+  for(i = 0; i < NZSWAP; i++){
+    zswap.entries[i].hnext = zswap.free;
+    zswap.free = &zswap.entries[i];
+  }
+  zswap.st.maxpages = ZSWAP_PAGES;
+}
+
+// LZ77 coder. The output is a sequence of groups of eight items,
+// each group led by a byte whose bits tell which items are matches.
+// A literal item is one byte. A match is two bytes: the length less
+// ZMINMATCH in the top ZLENBITS bits, and the distance back in the
+// other bits. Matches are found through a hash of the next 3 bytes.
+
+#define ZLENBITS  6
+#define ZMINMATCH 3
+#define ZMAXMATCH ((1<<ZLENBITS) + ZMINMATCH - 1)
+#define ZDISTMASK ((1<<(16-ZLENBITS)) - 1)
+#define ZLZHASH   1024
+
+static ushort lzhash[ZLZHASH];  // low bits of the last address with a hash
+
+// Compress the page at src into dst. Returns the compressed length,
+// or -1 if it would be longer than max.
+static int
+lz_compress(uchar *src, uchar *dst, int max)
+{
+  uchar *s, *d, *cpy, *map;
+  uint mask, h, dist, len;
+
+  memset(lzhash, 0, sizeof(lzhash));
+  s = src;
+  d = dst;
+  map = 0;
+  mask = 0x80;
+  while(s < src + PGSIZE){
+    if((mask <<= 1) == 0x100){
+      if(d + 1 + 2*8 > dst + max)
+        return -1;
+      mask = 1;
+      map = d++;
+      *map = 0;
+    }
+    if(s > src + PGSIZE - ZMAXMATCH){
+      *d++ = *s++;
+      continue;
+    }
+    h = (s[0] << 16) + (s[1] << 8) + s[2];
+    h += h >> 9;
+    h += h >> 5;
+    h &= ZLZHASH - 1;
+    dist = ((uint)s - lzhash[h]) & ZDISTMASK;
+    lzhash[h] = (ushort)(uint)s;
+    cpy = s - dist;
+    if(cpy >= src && cpy != s &&
+       cpy[0] == s[0] && cpy[1] == s[1] && cpy[2] == s[2]){
+      *map |= mask;
+      for(len = ZMINMATCH; len < ZMAXMATCH; len++)
+        if(s[len] != cpy[len])
+          break;
+      *d++ = ((len - ZMINMATCH) << (8 - ZLENBITS)) | (dist >> 8);
+      *d++ = dist;
+      s += len;
+    } else {
+      *d++ = *s++;
+    }
+  }
+  return d - dst;
+}
+
+static void
+lz_decompress(uchar *src, uchar *dst)
+{
+  uchar *d, *cpy, map;
+  uint mask, dist;
+  int len;
+
+  d = dst;
+  map = 0;
+  mask = 0x80;
+  while(d < dst + PGSIZE){
+    if((mask <<= 1) == 0x100){
+      mask = 1;
+      map = *src++;
+    }
+    if(map & mask){
+      len = (src[0] >> (8 - ZLENBITS)) + ZMINMATCH;
+      dist = ((src[0] << 8) | src[1]) & ZDISTMASK;
+      src += 2;
+      if((cpy = d - dist) < dst)
+        panic("lz_decompress");
+      if(len > dst + PGSIZE - d)
+        len = dst + PGSIZE - d;
+      while(--len >= 0)
+        *d++ = *cpy++;
+    } else {
+      *d++ = *src++;
+    }
+  }
+}
+
+// Is the page filled with one repeated word? If so, set *fill to it.
+static int
+samefilled(char *mem, uint *fill)
+{
+  uint *w = (uint*)mem;
+  int i;
+
+  for(i = 1; i < PGSIZE/sizeof(uint); i++)
+    if(w[i] != w[0])
+      return 0;
+  *fill = w[0];
+  return 1;
+}
+
+static struct zentry*
+zlookup(int slot)
+{
+  struct zentry *e;
+
+  for(e = zswap.hash[ZHASHSLOT(slot)]; e != 0; e = e->hnext)
+    if(e->slot == slot)
+      return e;
+  return 0;
+}
+
+static void
+lru_remove(struct zentry *e)
+{
+  if(e->prev)
+    e->prev->next = e->next;
+  else
+    zswap.oldest = e->next;
+  if(e->next)
+    e->next->prev = e->prev;
+  else
+    zswap.newest = e->prev;
+}
+
+// Take len bytes from the pool. Returns 0 if the pool is full.
+static char*
+zalloc(uint len)
+{
+  char *data;
+
+  if(zswap.cur == 0 || zswap.cur->used + len > PGSIZE){
+    if(zswap.st.pages >= zswap.st.maxpages)
+      return 0;
+    if((zswap.cur = (struct zpage*)kalloc()) == 0)
+      return 0;
+    zswap.cur->used = sizeof(struct zpage);
+    zswap.cur->live = 0;
+    zswap.st.pages++;
+  }
+  data = (char*)zswap.cur + zswap.cur->used;
+  zswap.cur->used += len;
+  zswap.cur->live++;
+  return data;
+}
+
+static void
+zfree(char *data)
+{
+  struct zpage *zp = (struct zpage*)PGROUNDDOWN((uint)data);
+
+  if(--zp->live > 0)
+    return;
+  if(zp == zswap.cur)
+    zswap.cur = 0;
+  kfree((char*)zp);
+  zswap.st.pages--;
+}
+
+// Give up the compressed copy of e. Caller holds zswap.lock.
+static void
+zdrop(struct zentry *e)
+{
+  if(e->len > 0)
+    zfree(e->data);
+  else
+    zswap.st.samefilled--;
+  zswap.st.stored--;
+  zswap.st.bytes -= e->len;
+}
+
+// Remove e from the hash and put it on the free list.
+static void
+zput(struct zentry *e)
+{
+  struct zentry **pp;
+
+  for(pp = &zswap.hash[ZHASHSLOT(e->slot)]; *pp != e; pp = &(*pp)->hnext)
+    ;
+  *pp = e->hnext;
+  e->hnext = zswap.free;
+  zswap.free = e;
+}
+
+static void
+zcopy(struct zentry *e, char *mem)
+{
+  uint *w;
+  int i;
+
+  if(e->writeback)
+    memmove(mem, e->data, PGSIZE);
+  else if(e->len > 0)
+    lz_decompress((uchar*)e->data, (uchar*)mem);
+  else
+    for(w = (uint*)mem, i = 0; i < PGSIZE/sizeof(uint); i++)
+      w[i] = e->fill;
+}
+
+// Write the oldest entry back to its slot on disk and free it.
+// Returns -1 if the pool is empty.
+static int
+zwriteback(void)
+{
+  struct zentry *e;
+  char *page;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  acquire(&zswap.lock);
+  if((e = zswap.oldest) == 0){
+    release(&zswap.lock);
+    kfree(page);
+    return -1;
+  }
+  // Keep the page in e during the write, for zswap_load.
+  lru_remove(e);
+  zcopy(e, page);
+  zdrop(e);
+  e->data = page;
+  e->writeback = 1;
+  zswap.st.writebacks++;
+  release(&zswap.lock);
+
+  // zswap_invalidate waits for us, so the slot stays in use.
+  swaprw(e->slot, &page, 1, 1);
+
+  acquire(&zswap.lock);
+  zput(e);
+  wakeup(e);
+  release(&zswap.lock);
+  kfree(page);
+  return 0;
+}
+
+// Keep the page at mem, swapped out to slot, in the pool.
+// Returns 0 if it is kept, -1 if it has to go to disk.
+int
+zswap_store(int slot, char *mem)
+{
+  struct zentry *e;
+  uint fill;
+  int len;
+
+  // Make room first, writing back sleeps.
+  while((zswap.free == 0 || (zswap.st.pages >= zswap.st.maxpages &&
+        (zswap.cur == 0 || zswap.cur->used + ZMAXLEN > PGSIZE))) &&
+        zwriteback() == 0)
+    ;
+
+  fill = 0;
+  acquire(&zswap.lock);
+  if(zlookup(slot) != 0)
+    panic("zswap_store");
+  if(zswap.st.maxpages == 0 || (e = zswap.free) == 0){
+    release(&zswap.lock);
+    return -1;
+  }
+  if(samefilled(mem, &fill)){
+    len = 0;
+  } else if((len = lz_compress((uchar*)mem, zswap.buf, ZMAXLEN)) < 0){
+    zswap.st.rejects++;
+    release(&zswap.lock);
+    return -1;
+  } else if((e->data = zalloc(len)) == 0){
+    release(&zswap.lock);
+    return -1;
+  } else {
+    memmove(e->data, zswap.buf, len);
+  }
+
+  zswap.free = e->hnext;
+  e->slot = slot;
+  e->len = len;
+  e->fill = fill;
+  e->writeback = 0;
+  e->hnext = zswap.hash[ZHASHSLOT(slot)];
+  zswap.hash[ZHASHSLOT(slot)] = e;
+  e->prev = zswap.newest;
+  e->next = 0;
+  if(zswap.newest)
+    zswap.newest->next = e;
+  else
+    zswap.oldest = e;
+  zswap.newest = e;
+
+  zswap.st.stored++;
+  zswap.st.bytes += len;
+  if(len == 0)
+    zswap.st.samefilled++;
+  release(&zswap.lock);
+  return 0;
+}
+
+// Copy the page swapped out to slot into mem, if the pool has it.
+// Returns 0 on a hit, -1 if the page has to be read from disk.
+// The entry stays until the slot is freed.
+int
+zswap_load(int slot, char *mem)
+{
+  struct zentry *e;
+
+  acquire(&zswap.lock);
+  if((e = zlookup(slot)) == 0){
+    zswap.st.misses++;
+    release(&zswap.lock);
+    return -1;
+  }
+  zcopy(e, mem);
+  zswap.st.hits++;
+  release(&zswap.lock);
+  return 0;
+}
+
+// The slot is being freed: drop its page from the pool. Waits for a
+// writeback of the page, so that the slot is not reused before it.
+void
+zswap_invalidate(int slot)
+{
+  struct zentry *e;
+
+  acquire(&zswap.lock);
+  while((e = zlookup(slot)) != 0 && e->writeback)
+    sleep(e, &zswap.lock);
+  if(e != 0){
+    lru_remove(e);
+    zdrop(e);
+    zput(e);
+  }
+  release(&zswap.lock);
+}
+
+// Set the size cap of the pool to n pages, writing back entries
+// until the pool fits. Returns the old cap.
+int
+zswap_setmax(int n)
+{
+  int old;
+
+  acquire(&zswap.lock);
+  old = zswap.st.maxpages;
+  zswap.st.maxpages = n;
+  release(&zswap.lock);
+  while(zswap.st.pages > n && zwriteback() == 0)
+    ;
+  return old;
+}
+
+void
+zswap_getstat(struct zswapstat *st)
+{
+  struct zswapstat s;
+
+  // st is a user address and may fault; copy it out after release.
+  acquire(&zswap.lock);
+  s = zswap.st;
+  release(&zswap.lock);
+  *st = s;
+}
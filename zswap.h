@@ -0,0 +1,12 @@
+// Statistics of the compressed swap pool, see zswap.c.
+struct zswapstat {
+  uint maxpages;    // Size cap of the pool, in pages
+  uint pages;       // Pages of memory used by the pool
+  uint stored;      // Swapped out pages held by the pool
+  uint bytes;       // Compressed size of the pages held
+  uint samefilled;  // Pages held as one repeated word
+  uint hits;        // Pages swapped in from the pool
+  uint misses;      // Pages swapped in from disk
+  uint rejects;     // Pages that did not compress well enough
+  uint writebacks;  // Pages written back to disk to make room
+};
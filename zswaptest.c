@@ -0,0 +1,101 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "zswap.h"
+
+// Compressed swap pool test.
+// Grows past the memstab capacity with pages of four kinds: zeroed,
+// filled with one byte, text and random. The first NPAGES pages are
+// swapped out, then read back and checked. Prints the hit rate and
+// the compression ratio of the pool.
+
+#define PGSIZE 4096
+#define NPAGES 1024
+
+char expect[PGSIZE];
+
+void fill(char *p, int i)
+{
+    static char text[] = "the quick brown fox jumps over the lazy dog ";
+    uint x;
+    int j;
+
+    switch (i % 4)
+    {
+    case 0:
+        memset(p, 0, PGSIZE);
+        break;
+    case 1:
+        memset(p, 1, PGSIZE);
+        break;
+    case 2:
+        for (j = 0; j < PGSIZE; j++)
+            p[j] = text[(i + j) % (sizeof(text) - 1)];
+        break;
+    default:
+        x = i;
+        for (j = 0; j < PGSIZE; j++)
+        {
+            x = x * 1103515245 + 12345;
+            p[j] = x >> 16;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct zswapstat st;
+    char *base, *p;
+    int i, j, bad, hits, misses;
+
+    printf(1, "================================\n");
+    printf(1, "Compressed swap pool test started.\n");
+
+    swappolicy(SWAP_FIFO);
+    base = sbrk(0);
+    for (i = 0; i < NUM_MEMSTAB_ENTRIES_CAPACITY + NPAGES; i++)
+    {
+        if ((p = sbrk(PGSIZE)) == (char *)-1)
+        {
+            printf(1, "sbrk failed after %d pages.\n", i);
+            exit();
+        }
+        fill(p, i);
+    }
+
+    zswapstat(&st);
+    printf(1, "Pool: %d of %d pages, %d swapped out pages held, %d same-filled.\n",
+           st.pages, st.maxpages, st.stored, st.samefilled);
+    printf(1, "%d rejected, %d written back.\n", st.rejects, st.writebacks);
+    if (st.pages > 0)
+        printf(1, "Compression ratio: %d.%d%d pages held per pool page.\n", st.stored / st.pages,
+               st.stored * 10 / st.pages % 10, st.stored * 100 / st.pages % 10);
+    hits = st.hits;
+    misses = st.misses;
+
+    bad = 0;
+    for (i = 0; i < NPAGES; i++)
+    {
+        fill(expect, i);
+        for (j = 0; j < PGSIZE; j++)
+            if (base[i * PGSIZE + j] != expect[j])
+                break;
+        if (j < PGSIZE)
+            bad++;
+    }
+
+    zswapstat(&st);
+    hits = st.hits - hits;
+    misses = st.misses - misses;
+    if (hits + misses > 0)
+        printf(1, "Hit rate: %d%% (%d hits, %d misses).\n",
+               hits * 100 / (hits + misses), hits, misses);
+
+    if (bad)
+        printf(1, "Compressed swap pool test failed: %d bad pages.\n", bad);
+    else
+        printf(1, "Compressed swap pool test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}